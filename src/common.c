@@ -109,18 +109,85 @@ typedef Array(String) StringArray;
 } while(0)
 
 typedef struct MapEntry {
-	void *val;
 	uint64_t hash;
+	uint64_t key;
+	uint64_t val; // 0 is used for missing values
 } MapEntry;
 
-// Taken from - https://github.com/pervognsen/bitwise/blob/master/ion/common.c
-// This is a mess, I have no idea if this is even a remotely good map now.
-typedef struct Map{
+// Open addressing in the style of Abseil's SwissTable. Every slot has a
+// control byte that is either MAP_EMPTY, MAP_DELETED or the top 7 bits of
+// the hash of the key stored there. Lookups compare a group of 16 control
+// bytes at once and only look at the keys whose 7 bits matched, so keys
+// are compared for real instead of trusting the 64-bit hash. The first
+// group is mirrored after the last slot so loading a group never wraps.
+// The control bytes live in the same allocation right after the entries,
+// which keeps Map small enough to sit inside a table object.
+typedef struct Map {
 	MapEntry *entries;
-	size_t len;
-	size_t cap;
+	uint32_t len;  // Live entries
+	uint32_t used; // Live entries and tombstones, what the load factor counts
+	uint32_t cap;
 } Map;
 
+// Compares the key stored in an entry with the key being looked up
+typedef bool (*MapKeyEq)(uint64_t stored, const void *key);
+
+#define MAP_GROUP   16
+#define MAP_EMPTY   0x80
+#define MAP_DELETED 0xFE
+#define MAP_H2(_hash) ((uint8_t)((_hash) >> 57))
+#define map_ctrl(_map) ((uint8_t*)((_map)->entries + (_map)->cap))
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define MAP_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Bit i is set if group[i] == byte
+uint32_t map_group_match(const uint8_t *group, uint8_t byte) {
+#ifdef MAP_SSE2
+	__m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+	return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)byte)));
+#else
+	uint32_t mask = 0;
+	for (int i = 0; i < MAP_GROUP; i++) {
+		if (group[i] == byte) mask |= 1u << i;
+	}
+	return mask;
+#endif
+}
+
+// Bit i is set if group[i] is empty or deleted, both have the high bit set
+uint32_t map_group_match_free(const uint8_t *group) {
+#ifdef MAP_SSE2
+	return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+#else
+	uint32_t mask = 0;
+	for (int i = 0; i < MAP_GROUP; i++) {
+		if (group[i] & 0x80) mask |= 1u << i;
+	}
+	return mask;
+#endif
+}
+
+int map_lowest_bit(uint32_t mask) {
+	assert(mask);
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return (int)index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+void map_set_ctrl(Map *map, size_t i, uint8_t ctrl) {
+	map_ctrl(map)[i] = ctrl;
+	if (i < MAP_GROUP) {
+		map_ctrl(map)[map->cap + i] = ctrl;
+	}
+}
+
 uint64_t hash_bytes(const char *buf, size_t len) {
 	uint64_t x = 0xcbf29ce484222325;
 	for (size_t i = 0; i < len; i++) {
@@ -144,94 +211,325 @@ uint64_t hash_ptr(void *ptr) {
 }
 
 #define IS_POW2(x) (((x) != 0) && ((x) & ((x)-1)) == 0)
-void* map_get(Map *map, uint64_t hash) {
-	if (map->len == 0) return 0;
 
+// Probes group by group with triangular steps, which visits every group
+// when the capacity is a power of two. Passing 0 for eq compares the keys
+// as plain integers, key must then point to a uint64_t.
+MapEntry* map_find(Map *map, uint64_t hash, MapKeyEq eq, const void *key) {
+	if (map->len == 0) return 0;
 	assert(IS_POW2(map->cap));
-	assert(map->len < map->cap);
-
-	size_t i = (size_t)hash;
-	for (;;) {
-		i &= map->cap - 1;
-		MapEntry *entry = &map->entries[i];
-		if (entry->hash == hash) {
-			return entry->val;
+
+	uint8_t h2 = MAP_H2(hash);
+	size_t mask = map->cap - 1;
+	size_t pos = (size_t)hash & mask;
+	for (size_t step = MAP_GROUP;; step += MAP_GROUP) {
+		const uint8_t *group = map_ctrl(map) + pos;
+		uint32_t match = map_group_match(group, h2);
+		while (match) {
+			MapEntry *e = &map->entries[(pos + map_lowest_bit(match)) & mask];
+			if (e->hash == hash && (eq ? eq(e->key, key) : e->key == *(const uint64_t*)key)) {
+				return e;
+			}
+			match &= match - 1;
 		}
-		else if (!entry->hash) {
+		if (map_group_match(group, MAP_EMPTY)) {
 			return 0;
 		}
-		i++;
+		pos = (pos + step) & mask;
 	}
+}
 
-	return 0;
+// First empty or deleted slot on the probe sequence for hash
+size_t map_find_free(Map *map, uint64_t hash) {
+	size_t mask = map->cap - 1;
+	size_t pos = (size_t)hash & mask;
+	for (size_t step = MAP_GROUP;; step += MAP_GROUP) {
+		uint32_t free_slots = map_group_match_free(map_ctrl(map) + pos);
+		if (free_slots) {
+			return (pos + map_lowest_bit(free_slots)) & mask;
+		}
+		pos = (pos + step) & mask;
+	}
 }
 
-void map_put_hash(Map *map, uint64_t hash, void *val);
-void map_grow(Map *map, size_t new_cap) {
-	new_cap = max(16, new_cap);
+// Bytes used by the entries and control bytes of a map with cap slots
+size_t map_alloc_size(size_t cap) {
+	return cap ? cap * sizeof(MapEntry) + cap + MAP_GROUP : 0;
+}
+
+// The capacity map_insert grows map to before adding a key, or 0 if there
+// is room. The map is kept at most 7/8 full counting tombstones, when it
+// fills up with tombstones it is rebuilt at the same size instead of growing.
+size_t map_grow_cap(Map *map) {
+	if (8 * ((size_t)map->used + 1) <= 7 * (size_t)map->cap) return 0;
+	size_t cap = map->cap;
+	if (2 * map->len >= cap) cap *= 2;
+	return max(MAP_GROUP, cap);
+}
+
+// Moves the entries into storage of map_alloc_size(new_cap) bytes and returns
+// the old storage, for maps whose storage does not come from malloc
+MapEntry* map_rehash(Map *map, void *storage, size_t new_cap) {
 	assert(IS_POW2(new_cap));
 	Map new_map = {
-		.entries = calloc(new_cap, sizeof(MapEntry)),
-		.cap = new_cap,
+		.entries = storage,
+		.cap = (uint32_t)new_cap,
 	};
+	memset(map_ctrl(&new_map), MAP_EMPTY, new_cap + MAP_GROUP);
 
 	for (size_t i = 0; i < map->cap; i++) {
-		MapEntry *e = &map->entries[i];
-		if (e->hash) {
-			map_put_hash(&new_map, e->hash, e->val);
+		if (!(map_ctrl(map)[i] & 0x80)) {
+			MapEntry *e = &map->entries[i];
+			size_t slot = map_find_free(&new_map, e->hash);
+			map_set_ctrl(&new_map, slot, MAP_H2(e->hash));
+			new_map.entries[slot] = *e;
+			new_map.len++;
 		}
 	}
+	new_map.used = new_map.len;
 
-	if (map->entries) {
-		free(map->entries);
-	}
+	MapEntry *old = map->entries;
 	*map = new_map;
+	return old;
+}
+
+void map_grow(Map *map, size_t new_cap) {
+	new_cap = max(MAP_GROUP, new_cap);
+	free(map_rehash(map, malloc(map_alloc_size(new_cap)), new_cap));
 }
 
-//TODO: Do string interning and remove c_hashmap completly
-void map_put_hash(Map *map, uint64_t hash, void *val) {
+// Adds a key that is known not to be in the map yet, see map_grow_cap. A map
+// with storage from elsewhere must be grown with map_rehash beforehand.
+void map_insert(Map *map, uint64_t hash, uint64_t key, uint64_t val) {
 	assert(val);
-	if (2 * map->len >= map->cap) {
-		map_grow(map, 2 * map->cap);
+	size_t cap = map_grow_cap(map);
+	if (cap) {
+		map_grow(map, cap);
 	}
 
-	assert(2 * map->len < map->cap);
-	assert(IS_POW2(map->cap));
-	size_t i = (size_t)hash;
-	for (;;) {
-		i &= map->cap - 1;
-		MapEntry *e = &map->entries[i];
-		if (!e->hash) {
-			map->len++;
-			e->val = val;
-			e->hash = hash;
-			return;
-		}
-		else if (e->hash == hash) {
-			e->val = val;
-			return;
-		}
-		i++;
+	size_t slot = map_find_free(map, hash);
+	if (map_ctrl(map)[slot] == MAP_EMPTY) {
+		map->used++;
 	}
+	map_set_ctrl(map, slot, MAP_H2(hash));
+	MapEntry *e = &map->entries[slot];
+	e->hash = hash;
+	e->key = key;
+	e->val = val;
+	map->len++;
+}
+
+// Leaves a tombstone so probe sequences going past the entry still work
+void map_remove(Map *map, MapEntry *e) {
+	size_t slot = e - map->entries;
+	assert(slot < map->cap);
+	map_set_ctrl(map, slot, MAP_DELETED);
+	e->val = 0;
+	map->len--;
+}
+
+// Calls _body with _e set to every live entry
+#define for_map(_map, _e) \
+	for (size_t it_slot = 0; it_slot < (_map).cap; it_slot++) \
+		if (!(map_ctrl(&(_map))[it_slot] & 0x80) && ((_e) = &(_map).entries[it_slot], true))
+
+// The map keeps its own copy of a string key
+bool string_key_eq(uint64_t stored, const void *key) {
+	const char *str = (const char*)(uintptr_t)stored;
+	const String *s = key;
+	return strncmp(str, s->str, s->len) == 0 && str[s->len] == 0;
 }
 
-void map_put_string(Map *map, String str, void *val) {
+void map_put_string(Map *map, String str, uint64_t val) {
 	uint64_t hash = hash_bytes(str.str, str.len);
-	map_put_hash(map, hash, val);
+	MapEntry *e = map_find(map, hash, string_key_eq, &str);
+	if (e) {
+		e->val = val;
+	}
+	else {
+		map_insert(map, hash, (uint64_t)(uintptr_t)make_string_copy(str).str, val);
+	}
 }
 
-void* map_get_string(Map *map, String str) {
+uint64_t map_get_string(Map *map, String str) {
 	uint64_t hash = hash_bytes(str.str, str.len);
-	return map_get(map, hash);
+	MapEntry *e = map_find(map, hash, string_key_eq, &str);
+	return e ? e->val : 0;
 }
 
 void map_free(Map *map) {
 	map->cap = 0;
 	map->len = 0;
+	map->used = 0;
 
 	free(map->entries);
+	map->entries = 0;
+}
+
+// Threads, locks and atomics, used by the parallel marking and background
+// sweeping of the gc
+typedef void (*ThreadFunc)(void *arg);
+
+typedef struct ThreadStart {
+	ThreadFunc func;
+	void *arg;
+} ThreadStart;
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#define THREAD_LOCAL __declspec(thread)
+
+typedef HANDLE Thread;
+typedef SRWLOCK Lock;
+
+DWORD WINAPI thread_entry(LPVOID param) {
+	ThreadStart start = *(ThreadStart*)param;
+	free(param);
+	start.func(start.arg);
+	return 0;
+}
+
+void thread_start(Thread *thread, ThreadFunc func, void *arg) {
+	ThreadStart *start = malloc(sizeof(ThreadStart));
+	start->func = func;
+	start->arg = arg;
+	*thread = CreateThread(0, 0, thread_entry, start, 0, 0);
+}
+
+void thread_join(Thread thread) {
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+}
+
+void thread_yield() {
+	SwitchToThread();
+}
+
+void lock_init(Lock *lock) {
+	InitializeSRWLock(lock);
+}
+
+void lock_acquire(Lock *lock) {
+	AcquireSRWLockExclusive(lock);
+}
+
+void lock_release(Lock *lock) {
+	ReleaseSRWLockExclusive(lock);
+}
+
+// Returns the value before the or
+uint64_t atomic_or_u64(volatile uint64_t *p, uint64_t v) {
+	return (uint64_t)InterlockedOr64((volatile LONG64*)p, (LONG64)v);
 }
 
+// Returns the value after the add
+long atomic_add_long(volatile long *p, long v) {
+	return InterlockedExchangeAdd(p, v) + v;
+}
+
+long atomic_load_long(volatile long *p) {
+	return InterlockedOr(p, 0);
+}
+
+void atomic_store_long(volatile long *p, long v) {
+	InterlockedExchange(p, v);
+}
+
+uint64_t atomic_load_u64(volatile uint64_t *p) {
+	return (uint64_t)InterlockedOr64((volatile LONG64*)p, 0);
+}
+#elif POSIX
+#include <pthread.h>
+#include <sched.h>
+#define THREAD_LOCAL __thread
+
+typedef pthread_t Thread;
+typedef pthread_mutex_t Lock;
+
+void* thread_entry(void *param) {
+	ThreadStart start = *(ThreadStart*)param;
+	free(param);
+	start.func(start.arg);
+	return 0;
+}
+
+void thread_start(Thread *thread, ThreadFunc func, void *arg) {
+	ThreadStart *start = malloc(sizeof(ThreadStart));
+	start->func = func;
+	start->arg = arg;
+	pthread_create(thread, 0, thread_entry, start);
+}
+
+void thread_join(Thread thread) {
+	pthread_join(thread, 0);
+}
+
+void thread_yield() {
+	sched_yield();
+}
+
+void lock_init(Lock *lock) {
+	pthread_mutex_init(lock, 0);
+}
+
+void lock_acquire(Lock *lock) {
+	pthread_mutex_lock(lock);
+}
+
+void lock_release(Lock *lock) {
+	pthread_mutex_unlock(lock);
+}
+
+// Returns the value before the or
+uint64_t atomic_or_u64(volatile uint64_t *p, uint64_t v) {
+	return __atomic_fetch_or(p, v, __ATOMIC_SEQ_CST);
+}
+
+// Returns the value after the add
+long atomic_add_long(volatile long *p, long v) {
+	return __atomic_add_fetch(p, v, __ATOMIC_SEQ_CST);
+}
+
+long atomic_load_long(volatile long *p) {
+	return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+}
+
+void atomic_store_long(volatile long *p, long v) {
+	__atomic_store_n(p, v, __ATOMIC_SEQ_CST);
+}
+
+uint64_t atomic_load_u64(volatile uint64_t *p) {
+	return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+}
+#else
+#error Implement threads for this platform
+#endif
+
+// Pages straight from the OS, so freeing them always gives the memory back
+// instead of leaving it with the C runtime
+#ifdef _WIN32
+void* os_alloc(size_t size) {
+	return VirtualAlloc(0, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+}
+
+void os_free(void *ptr, size_t size) {
+	VirtualFree(ptr, 0, MEM_RELEASE);
+}
+#elif POSIX
+#include <sys/mman.h>
+void* os_alloc(size_t size) {
+	void *result = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return result == MAP_FAILED ? 0 : result;
+}
+
+void os_free(void *ptr, size_t size) {
+	munmap(ptr, size);
+}
+#else
+#error Implement os_alloc for this platform
+#endif
+
 typedef struct Bucket Bucket;
 struct Bucket {
 	void *arena;
@@ -240,92 +538,559 @@ struct Bucket {
 	size_t element_size;
 	size_t count;
 	Bucket *next;
+	Bucket **prev; // The list head or next field pointing at this bucket
+
+	// Released elements, linked through the word after their first so the
+	// first can hold the 0xCAFEBABE poison
+	void *free_list;
+
+	// One bit per element. Live is set while an element is allocated, marks
+	// are left to the user of the pool, see pool_mark and pool_sweep_bucket.
+	uint64_t *live;
+	uint64_t *marks;
 };
 
+// Every bucket but the current one is in exactly one list of its pool:
+// partial buckets have released elements to reuse, old buckets are full and
+// free buckets are empty and ready to become the current bucket again.
 typedef struct Pool {
 	Bucket *current_bucket;
+	Bucket *partial_buckets;
 	Bucket *free_buckets;
 	Bucket *old_buckets;
 	size_t element_size;
 	size_t bucket_size;
 	size_t buckets;
+
+	// Buckets left for pool_sweep_next, which may run on another thread. The
+	// lock guards the bucket lists and buckets while it does.
+	Bucket *sweep_buckets;
+	bool sweeping;
+	Lock lock;
 } Pool;
 
+void bucket_push(Bucket **list, Bucket *bucket) {
+	bucket->next = *list;
+	if (*list) {
+		(*list)->prev = &bucket->next;
+	}
+	bucket->prev = list;
+	*list = bucket;
+}
+
+void bucket_unlink(Bucket *bucket) {
+	*bucket->prev = bucket->next;
+	if (bucket->next) {
+		bucket->next->prev = bucket->prev;
+	}
+	bucket->next = 0;
+	bucket->prev = 0;
+}
+
+Bucket* bucket_pop(Bucket **list) {
+	Bucket *bucket = *list;
+	if (bucket) {
+		bucket_unlink(bucket);
+	}
+	return bucket;
+}
+
 Bucket* __pool_make_bucket(Pool *pool) {
 	Bucket *bucket = calloc(1, sizeof(Bucket));
 
 	bucket->element_size = pool->element_size;
 	bucket->bucket_size = pool->bucket_size;
-	bucket->arena = malloc(bucket->bucket_size);
+	bucket->arena = os_alloc(bucket->bucket_size);
 	bucket->bucket_used = 0;
 	bucket->count = 0;
 	bucket->next = 0;
 
+	size_t words = (bucket->bucket_size / bucket->element_size + 63) / 64;
+	bucket->live = calloc(words, sizeof(uint64_t));
+	bucket->marks = calloc(words, sizeof(uint64_t));
+
 	pool->buckets++;
 
 	return bucket;
 }
 
 void pool_init(Pool *pool, size_t element_size, size_t bucket_size) {
+	assert(element_size >= 2 * sizeof(void*));
 	pool->buckets = 0;
 	pool->element_size = element_size + sizeof(Bucket*);
 	pool->bucket_size = bucket_size * element_size;
 	pool->old_buckets = 0;
+	pool->partial_buckets = 0;
+	pool->free_buckets = 0;
+	pool->sweep_buckets = 0;
+	pool->sweeping = false;
+	lock_init(&pool->lock);
 	pool->current_bucket = __pool_make_bucket(pool);
 }
 
-void* pool_alloc(Pool *pool) {
-	if (pool->current_bucket->bucket_used + pool->current_bucket->element_size > pool->current_bucket->bucket_size) {
-		Bucket *old = pool->current_bucket;
+// Retires the full current bucket. Buckets with released elements are reused
+// first, then empty ones. While a sweep is running either may still turn up,
+// so a new bucket is only made once there is nothing left to sweep.
+void pool_next_bucket(Pool *pool) {
+	lock_acquire(&pool->lock);
+	while (!pool->partial_buckets && !pool->free_buckets && pool->sweeping) {
+		lock_release(&pool->lock);
+		thread_yield();
+		lock_acquire(&pool->lock);
+	}
 
-		if (pool->free_buckets) {
-			Bucket *new = pool->free_buckets;
-			pool->free_buckets = new->next;
-			pool->current_bucket = new;
-		}
-		else {
-			pool->current_bucket = __pool_make_bucket(pool);
-		}
+	bucket_push(&pool->old_buckets, pool->current_bucket);
+	if (pool->partial_buckets) {
+		pool->current_bucket = bucket_pop(&pool->partial_buckets);
+	}
+	else if (pool->free_buckets) {
+		pool->current_bucket = bucket_pop(&pool->free_buckets);
+		pool->buckets++;
+	}
+	else {
+		pool->current_bucket = __pool_make_bucket(pool);
+	}
+	lock_release(&pool->lock);
+}
 
-		old->next = pool->old_buckets;
-		pool->old_buckets = old;
+void* pool_alloc(Pool *pool) {
+	Bucket *bucket = pool->current_bucket;
+	if (!bucket->free_list && bucket->bucket_used + bucket->element_size > bucket->bucket_size) {
+		pool_next_bucket(pool);
+		bucket = pool->current_bucket;
 	}
-	Bucket **result = (Bucket**)((uint8_t*)(pool->current_bucket->arena) + pool->current_bucket->bucket_used);
-	pool->current_bucket->bucket_used += pool->current_bucket->element_size;
-	memset(result, 0, pool->current_bucket->element_size);
-	*result = pool->current_bucket;
-	pool->current_bucket->count++;
+
+	Bucket **result;
+	if (bucket->free_list) {
+		result = (Bucket**)bucket->free_list - 1;
+		bucket->free_list = ((void**)bucket->free_list)[1];
+	}
+	else {
+		result = (Bucket**)((uint8_t*)bucket->arena + bucket->bucket_used);
+		bucket->bucket_used += bucket->element_size;
+	}
+	size_t index = ((uint8_t*)result - (uint8_t*)bucket->arena) / bucket->element_size;
+	bucket->live[index / 64] |= 1ull << (index % 64);
+	memset(result, 0, bucket->element_size);
+	*result = bucket;
+	bucket->count++;
 	result++;
 	return result;
 }
 
-void pool_release(Pool *pool, void *ptr) {
+// Returns the bucket ptr was allocated from and sets index to its element index
+Bucket* pool_bucket_of(void *ptr, size_t *index) {
 	Bucket **header = ptr;
 	header--;
-	Bucket *owner_bucket = *header;
-	owner_bucket->count--;
-	uint64_t *freed_value = ptr;
-	*freed_value = 0xCAFEBABE;
+	Bucket *bucket = *header;
+	*index = ((uint8_t*)header - (uint8_t*)bucket->arena) / bucket->element_size;
+	return bucket;
+}
 
-	Bucket **bucket = &pool->old_buckets;
-	while (*bucket) {
-		if ((*bucket)->count == 0) {
-			Bucket *old = *bucket;
-			*bucket = old->next;
+bool pool_marked(void *ptr) {
+	size_t index;
+	Bucket *bucket = pool_bucket_of(ptr, &index);
+	return (bucket->marks[index / 64] >> (index % 64)) & 1;
+}
 
-			old->bucket_used = 0;
+void pool_mark(void *ptr) {
+	size_t index;
+	Bucket *bucket = pool_bucket_of(ptr, &index);
+	bucket->marks[index / 64] |= 1ull << (index % 64);
+}
+
+// Like pool_mark but safe while other threads mark elements of the same
+// bucket. Returns false if ptr was already marked.
+bool pool_mark_shared(void *ptr) {
+	size_t index;
+	Bucket *bucket = pool_bucket_of(ptr, &index);
+	uint64_t bit = 1ull << (index % 64);
+	if (atomic_load_u64(&bucket->marks[index / 64]) & bit) return false;
+	return !(atomic_or_u64(&bucket->marks[index / 64], bit) & bit);
+}
 
-			old->next = pool->free_buckets;
-			pool->free_buckets = old;
+// Puts the element at index on the free list of its bucket
+void bucket_free_element(Bucket *bucket, size_t index) {
+	bucket->live[index / 64] &= ~(1ull << (index % 64));
+	bucket->marks[index / 64] &= ~(1ull << (index % 64));
+	bucket->count--;
 
-			pool->buckets--;
+	void **freed = (void**)((uint8_t*)bucket->arena + index * bucket->element_size + sizeof(Bucket*));
+	freed[0] = (void*)0xCAFEBABE;
+	freed[1] = bucket->free_list;
+	bucket->free_list = freed;
+}
+
+// Moves bucket to the list that matches how full it is, bucket must not be in
+// any list. An empty bucket forgets its free list since allocation starts over
+// from the front of its arena.
+void pool_file_bucket(Pool *pool, Bucket *bucket) {
+	if (bucket->count == 0) {
+		bucket->bucket_used = 0;
+		bucket->free_list = 0;
+		bucket_push(&pool->free_buckets, bucket);
+		pool->buckets--;
+	}
+	else if (bucket->free_list) {
+		bucket_push(&pool->partial_buckets, bucket);
+	}
+	else {
+		bucket_push(&pool->old_buckets, bucket);
+	}
+}
+
+void pool_release(Pool *pool, void *ptr) {
+	size_t index;
+	Bucket *bucket = pool_bucket_of(ptr, &index);
+	bool was_full = !bucket->free_list;
+	bucket_free_element(bucket, index);
+
+	// Only a bucket that just became partial or empty changes lists
+	if (bucket == pool->current_bucket || (!was_full && bucket->count > 0)) return;
+
+	lock_acquire(&pool->lock);
+	bucket_unlink(bucket);
+	pool_file_bucket(pool, bucket);
+	lock_release(&pool->lock);
+}
+
+int lowest_bit64(uint64_t mask) {
+	assert(mask);
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, mask);
+	return (int)index;
+#else
+	return __builtin_ctzll(mask);
+#endif
+}
+
+// Returns true if it freed element, which is then released from the pool
+typedef bool (*PoolSweepFunc)(void *user, void *element);
+
+// Calls sweep on every allocated element that is not marked, a word of the
+// bitmaps at a time, and clears the marks. Leaves the bucket in whatever list
+// it is in, see pool_file_bucket.
+void pool_sweep_bucket(Bucket *bucket, PoolSweepFunc sweep, void *user) {
+	size_t words = (bucket->bucket_used / bucket->element_size + 63) / 64;
+	for (size_t w = 0; w < words; w++) {
+		uint64_t unmarked = bucket->live[w] & ~bucket->marks[w];
+		bucket->marks[w] = 0;
+		while (unmarked) {
+			size_t index = w * 64 + lowest_bit64(unmarked);
+			unmarked &= unmarked - 1;
+			Bucket **header = (Bucket**)((uint8_t*)bucket->arena + index * bucket->element_size);
+			if (sweep(user, header + 1)) {
+				bucket_free_element(bucket, index);
+			}
 		}
-		else {
-			bucket = &(*bucket)->next;
+	}
+}
+
+// Hands every bucket except the current one to pool_sweep_next, the caller
+// sweeps the current bucket itself since allocation continues in it. Must not
+// be called while a previous sweep is still running.
+void pool_begin_sweep(Pool *pool) {
+	lock_acquire(&pool->lock);
+	assert(!pool->sweeping);
+	Bucket *bucket;
+	while ((bucket = bucket_pop(&pool->old_buckets))) {
+		bucket_push(&pool->sweep_buckets, bucket);
+	}
+	while ((bucket = bucket_pop(&pool->partial_buckets))) {
+		bucket_push(&pool->sweep_buckets, bucket);
+	}
+	pool->sweeping = pool->sweep_buckets != 0;
+	lock_release(&pool->lock);
+}
+
+// Sweeps a batch of the buckets handed out by pool_begin_sweep, returns false
+// once none are left. Runs on the sweeper thread while the pool keeps
+// allocating from buckets that are not being swept. Swept buckets are filed
+// a batch at a time so the lock is not taken for every bucket.
+#define POOL_SWEEP_BATCH 16
+bool pool_sweep_next(Pool *pool, PoolSweepFunc sweep, void *user) {
+	Bucket *batch[POOL_SWEEP_BATCH];
+	int count = 0;
+	lock_acquire(&pool->lock);
+	while (count < POOL_SWEEP_BATCH && pool->sweep_buckets) {
+		batch[count++] = bucket_pop(&pool->sweep_buckets);
+	}
+	lock_release(&pool->lock);
+	if (count == 0) return false;
+
+	for (int i = 0; i < count; i++) {
+		pool_sweep_bucket(batch[i], sweep, user);
+	}
+
+	lock_acquire(&pool->lock);
+	for (int i = 0; i < count; i++) {
+		pool_file_bucket(pool, batch[i]);
+	}
+	if (!pool->sweep_buckets) {
+		pool->sweeping = false;
+	}
+	lock_release(&pool->lock);
+	return true;
+}
+
+// Buckets that hold or are taking elements, the free ones are not counted
+size_t pool_bucket_count(Pool *pool) {
+	lock_acquire(&pool->lock);
+	size_t result = pool->buckets;
+	lock_release(&pool->lock);
+	return result;
+}
+
+// Gives all but keep of the free buckets back to the OS
+void pool_trim(Pool *pool, size_t keep) {
+	lock_acquire(&pool->lock);
+	Bucket **link = &pool->free_buckets;
+	for (size_t i = 0; i < keep && *link; i++) {
+		link = &(*link)->next;
+	}
+	Bucket *bucket;
+	while ((bucket = bucket_pop(link))) {
+		os_free(bucket->arena, bucket->bucket_size);
+		free(bucket->live);
+		free(bucket->marks);
+		free(bucket);
+	}
+	lock_release(&pool->lock);
+}
+
+typedef void (*PoolVisitFunc)(void *user, void *element);
+
+void pool_visit_bucket(Bucket *bucket, PoolVisitFunc visit, void *user) {
+	size_t words = (bucket->bucket_used / bucket->element_size + 63) / 64;
+	for (size_t w = 0; w < words; w++) {
+		uint64_t live = bucket->live[w];
+		while (live) {
+			size_t index = w * 64 + lowest_bit64(live);
+			live &= live - 1;
+			Bucket **header = (Bucket**)((uint8_t*)bucket->arena + index * bucket->element_size);
+			visit(user, header + 1);
 		}
 	}
 }
 
+// Calls visit on every allocated element, only while no sweep is running
+void pool_visit(Pool *pool, PoolVisitFunc visit, void *user) {
+	assert(!pool->sweeping);
+	pool_visit_bucket(pool->current_bucket, visit, user);
+	for (Bucket *b = pool->partial_buckets; b; b = b->next) {
+		pool_visit_bucket(b, visit, user);
+	}
+	for (Bucket *b = pool->old_buckets; b; b = b->next) {
+		pool_visit_bucket(b, visit, user);
+	}
+}
+
+// Takes the buckets less than percent full out of the pool, linked through
+// next, so they can be emptied without new elements landing in them. Each
+// has to be given back with pool_return_bucket.
+Bucket* pool_take_sparse(Pool *pool, size_t percent) {
+	assert(!pool->sweeping);
+	size_t capacity = pool->bucket_size / pool->element_size;
+	Bucket *sparse = 0;
+	Bucket **lists[] = { &pool->partial_buckets, &pool->old_buckets };
+	for (int i = 0; i < 2; i++) {
+		Bucket *bucket = *lists[i];
+		while (bucket) {
+			Bucket *next = bucket->next;
+			if (bucket->count * 100 < capacity * percent) {
+				bucket_unlink(bucket);
+				bucket->next = sparse;
+				sparse = bucket;
+			}
+			bucket = next;
+		}
+	}
+	return sparse;
+}
+
+// Puts a bucket from pool_take_sparse back. If empty is set every element in
+// it is released at once, without poisoning them one by one.
+void pool_return_bucket(Pool *pool, Bucket *bucket, bool empty) {
+	if (empty) {
+		size_t words = (bucket->bucket_size / bucket->element_size + 63) / 64;
+		memset(bucket->live, 0, words * sizeof(uint64_t));
+		memset(bucket->marks, 0, words * sizeof(uint64_t));
+		bucket->count = 0;
+	}
+	bucket->next = 0;
+	lock_acquire(&pool->lock);
+	pool_file_bucket(pool, bucket);
+	lock_release(&pool->lock);
+}
+
+// Size classes for the storage objects own besides their pool slot, like the
+// array, fields and map of a table or the bytes of a string. Each class is a
+// pool of its own, so freed blocks are reused by the next block of the same
+// class and emptied buckets are recycled whole. Blocks larger than the
+// largest class come from malloc.
+//
+// Blocks start with the same header word as pool elements: the bucket for
+// pooled blocks, or the size shifted up with the low bit set for large ones.
+// Blocks may be freed on another thread while it is shared, see heap_share.
+size_t heap_class_sizes[] = {
+	16, 24, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, 4096,
+};
+#define HEAP_CLASS_COUNT (sizeof(heap_class_sizes) / sizeof(heap_class_sizes[0]))
+#define HEAP_BUCKET_BYTES (64 * 1024)
+
+typedef struct Heap {
+	Pool classes[HEAP_CLASS_COUNT];
+	size_t bytes; // Allocated, rounded up to the size classes
+	bool shared;
+	Lock lock;
+} Heap;
+
+void heap_init(Heap *heap) {
+	for (size_t i = 0; i < HEAP_CLASS_COUNT; i++) {
+		pool_init(&heap->classes[i], heap_class_sizes[i], HEAP_BUCKET_BYTES / heap_class_sizes[i]);
+	}
+	heap->bytes = 0;
+	heap->shared = false;
+	lock_init(&heap->lock);
+}
+
+// While shared every call takes the lock, so a sweeper thread can free
+// blocks as the program allocates them
+void heap_share(Heap *heap, bool shared) {
+	heap->shared = shared;
+}
+
+// Returns the smallest class that fits size, or HEAP_CLASS_COUNT if none does
+size_t heap_class(size_t size) {
+	size_t i = 0;
+	while (i < HEAP_CLASS_COUNT && heap_class_sizes[i] < size) i++;
+	return i;
+}
+
+// The usable size of a block, which is what its class rounded up to
+size_t heap_size(void *ptr) {
+	uintptr_t header = ((uintptr_t*)ptr)[-1];
+	if (header & 1) {
+		return header >> 1;
+	}
+	return ((Bucket*)header)->element_size - sizeof(Bucket*);
+}
+
+// Like malloc the block is not cleared. Returns 0 for 0 bytes.
+void* heap_alloc(Heap *heap, size_t size) {
+	if (size == 0) return 0;
+	if (heap->shared) lock_acquire(&heap->lock);
+
+	void *result;
+	size_t class = heap_class(size);
+	if (class < HEAP_CLASS_COUNT) {
+		result = pool_alloc(&heap->classes[class]);
+	}
+	else {
+		uintptr_t *header = malloc(sizeof(uintptr_t) + size);
+		*header = (size << 1) | 1;
+		result = header + 1;
+	}
+	heap->bytes += heap_size(result);
+
+	if (heap->shared) lock_release(&heap->lock);
+	return result;
+}
+
+void heap_free(Heap *heap, void *ptr) {
+	if (!ptr) return;
+	if (heap->shared) lock_acquire(&heap->lock);
+
+	size_t size = heap_size(ptr);
+	heap->bytes -= size;
+	size_t class = heap_class(size);
+	if (class < HEAP_CLASS_COUNT) {
+		pool_release(&heap->classes[class], ptr);
+	}
+	else {
+		free((uintptr_t*)ptr - 1);
+	}
+
+	if (heap->shared) lock_release(&heap->lock);
+}
+
+// Only ever moves to a larger block, a smaller size keeps the block as is
+void* heap_realloc(Heap *heap, void *ptr, size_t size) {
+	if (!ptr) return heap_alloc(heap, size);
+	size_t old_size = heap_size(ptr);
+	if (size <= old_size) return ptr;
+
+	void *result = heap_alloc(heap, size);
+	memcpy(result, ptr, old_size);
+	heap_free(heap, ptr);
+	return result;
+}
+
+// Bytes allocated, safe to call while a sweeper is freeing blocks
+size_t heap_bytes(Heap *heap) {
+	if (heap->shared) lock_acquire(&heap->lock);
+	size_t result = heap->bytes;
+	if (heap->shared) lock_release(&heap->lock);
+	return result;
+}
+
+// Gives all but one in keep of the free buckets of each class back to the OS
+void heap_trim(Heap *heap, size_t keep) {
+	for (size_t i = 0; i < HEAP_CLASS_COUNT; i++) {
+		pool_trim(&heap->classes[i], heap->classes[i].buckets / keep + 1);
+	}
+}
+
+// A copy of str in the heap, with a terminating zero like make_string_copy
+String heap_string_copy(Heap *heap, String str) {
+	String result;
+	result.len = str.len;
+	result.str = heap_alloc(heap, str.len + 1);
+	memcpy(result.str, str.str, str.len);
+	result.str[str.len] = 0;
+	return result;
+}
+
+// Bump allocator for data that lives until the program exits, nothing in it
+// is ever freed. Allocations are zeroed like those of a pool.
+typedef struct ArenaBlock ArenaBlock;
+struct ArenaBlock {
+	ArenaBlock *next;
+	size_t used;
+	size_t size;
+};
+
+typedef struct Arena {
+	ArenaBlock *block;
+	size_t block_size;
+	size_t bytes; // Handed out so far
+} Arena;
+
+void arena_init(Arena *arena, size_t block_size) {
+	arena->block = 0;
+	arena->block_size = block_size;
+	arena->bytes = 0;
+}
+
+void* arena_alloc(Arena *arena, size_t size) {
+	size = (size + 7) & ~(size_t)7;
+	ArenaBlock *block = arena->block;
+	if (!block || block->used + size > block->size) {
+		size_t block_size = max(arena->block_size, size);
+		block = malloc(sizeof(ArenaBlock) + block_size);
+		block->next = arena->block;
+		block->used = 0;
+		block->size = block_size;
+		arena->block = block;
+	}
+	void *result = (uint8_t*)(block + 1) + block->used;
+	block->used += size;
+	arena->bytes += size;
+	memset(result, 0, size);
+	return result;
+}
+
 /*
 typedef struct Bucket Bucket;
 struct Bucket {
@@ -451,4 +1216,5 @@ int bs_getch() {
 }
 #else
 #error Implement bs_getch for this platform
-#endif
\ No newline at end of file
+#endif
+
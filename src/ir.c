@@ -5,42 +5,57 @@ typedef enum FunctionKind {
 } FunctionKind;
 
 typedef struct Ir Ir;
-typedef struct Scope Scope;
-typedef struct Value Value;
-typedef Array(Value*) ValueArray;
+typedef struct Resolver Resolver;
+typedef uint64_t Value;
+typedef Array(Value) ValueArray;
+typedef struct Object Object;
+typedef struct Expr Expr;
+typedef Array(Expr*) ExprArray;
 typedef struct Stmt Stmt;
 typedef Array(Stmt*) StmtArray;
-
-typedef enum GCColor {
-	GC_WHITE = 1,
-	GC_GREY  = 2,
-	GC_BLACK = 3,
-} GCColor;
+typedef struct Chunk Chunk;
+typedef struct CallFrame CallFrame;
+typedef struct GCWorker GCWorker;
+
+// Whether an old object is marked is kept in the mark bitmap of its pool
+// bucket, see pool_mark. Marked objects on ir->grey_stack are grey, the rest
+// are black.
+typedef enum GCFlags {
+	GC_YOUNG      = 1, // In the nursery, see gc_minor
+	GC_IMMORTAL   = 2, // Literals, never scanned or freed, see make_immortal
+	GC_REMEMBERED = 4, // Old object in ir->remembered, see gc_write_barrier
+	GC_FORWARDED  = 8, // Moved to Object.forwarded, see gc_compact
+} GCFlags;
 
 typedef enum GCKind {
-	GC_VALUE = 1,
-	GC_STMT  = 2,
-	GC_SCOPE = 3,
+	GC_OBJECT = 1,
 } GCKind;
 
 
 typedef struct GCObject GCObject;
 struct GCObject {
-	GCColor color;
-	GCKind gc_kind;
-	GCObject *prev;
-	GCObject *next;
+	uint8_t gc_kind;  // GCKind
+	uint8_t gc_flags; // GCFlags
 };
 
-Value* eval_value(Ir *ir, Scope *scope, Value *v);
-void table_put(Ir *ir, Value *table, Value *key, Value *expr);
-void table_put_name(Ir *ir, Value *table, String name, Value *expr);
-Value* call_function(Ir *ir, Value *func_value, ValueArray args, bool is_method_call);
+Value eval_value(Ir *ir, Value *frame, Expr *expr);
+void table_put(Ir *ir, Value table, Value key, Value val);
+void table_put_name(Ir *ir, Value table, String name, Value val);
+Value intern_string(Ir *ir, String str);
+Value find_interned_string(Ir *ir, String str);
+Value make_literal(Ir *ir, Value v);
+Value call_function(Ir *ir, Value func_value, ValueArray args, bool is_method_call);
 StmtArray convert_nodes_to_stmts(Ir *ir, NodeArray nodes);
-Value* expr_to_value(Ir *ir, Node *n);
+Expr* expr_to_value(Ir *ir, Node *n);
 void add_globals(Ir *ir); // Found in runtime.c
-void free_stmt(Ir *ir, Stmt *stmt);
 void gc_add_to_grey(Ir *ir, GCObject *obj);
+void gc_write_barrier(Ir *ir, Object *t, Value v);
+void vm_locate(Ir *ir);                       // Found in vm.c
+void gc_mark_chunk(Ir *ir, Chunk *chunk);     // Found in vm.c
+void free_chunk(Chunk *chunk);                // Found in vm.c
+void init_vm(Ir *ir);                         // Found in vm.c
+Value vm_call(Ir *ir, Value func_value, ValueArray args);    // Found in vm.c
+Value vm_eval_top_level(Ir *ir, Node *expr);  // Found in vm.c
 
 #ifdef _WIN32
 __declspec(noreturn)
@@ -56,10 +71,13 @@ typedef struct Function {
 	union {
 		struct {
 			StringArray arg_names;
-			StmtArray stmts;
+			StmtArray stmts;  // Only used by the tree walker
+			size_t frame_size; // Slots the tree walker reserves for arguments and locals
+			Node *block;
+			Chunk *chunk;     // Compiled on the first call
 		} normal;
 		struct {
-			Value* (*function)(Ir *ir, ValueArray args);
+			Value (*function)(Ir *ir, ValueArray args);
 		} native;
 		struct {
 			void *temp;
@@ -67,98 +85,207 @@ typedef struct Function {
 	};
 } Function;
 
+// VALUE_NULL and VALUE_NUMBER are stored inside the Value itself, the rest are
+// the kinds of heap Objects
 typedef enum ValueKind {
 	VALUE_NULL = 0,
 	VALUE_NUMBER,
 	VALUE_STRING,
 	VALUE_TABLE,
-	VALUE_TABLE_CONSTANT,
 	VALUE_FUNCTION,
-	VALUE_BINOP,
-	VALUE_UNARY,
-	VALUE_NAME,
-	VALUE_INDEX,
-	VALUE_CALL,
-	VALUE_METHOD_CALL,
-	VALUE_FIELD,
 	VALUE_USERDATA,
-	VALUE_INCDEC,
 } ValueKind;
 
-#define isnull(_v)     ((_v)->kind == VALUE_NULL)
-#define isnumber(_v)   ((_v)->kind == VALUE_NUMBER)
-#define isstring(_v)   ((_v)->kind == VALUE_STRING)
-#define istable(_v)    ((_v)->kind == VALUE_TABLE)
-#define isfunction(_v) ((_v)->kind == VALUE_FUNCTION)
-#define isbinop(_v)    ((_v)->kind == VALUE_BINOP)
-#define isname(_v)     ((_v)->kind == VALUE_NAME)
-#define isunary(_v)    ((_v)->kind == VALUE_UNARY)
-#define isindex(_v)    ((_v)->kind == VALUE_INDEX)
-#define iscall(_v)     ((_v)->kind == VALUE_CALL)
-#define isfield(_v)    ((_v)->kind == VALUE_FIELD)
-#define isuserdata(_v) ((_v)->kind == VALUE_USERDATA)
-
-// lowest level of expr: null,number,string,table
-#define isbasic(_v) (isnull(_v) || isnumber(_v) || isstring(_v) || istable(_v))
-
-struct Value {
+// Values are NaN-boxed into 64 bits so numbers and null never touch the heap.
+// Heap pointers are stored as is, they are 8 byte aligned and have the upper 16
+// bits clear. Numbers are stored as their bits plus 2^49 which moves every
+// double, including the canonical NaN, above any pointer. That leaves small
+// integers like null free and makes 0 an invalid Value, which is what Map uses
+// to mean "not found".
+#define NUMBER_OFFSET (1ull << 49)
+#define CANONICAL_NAN 0x7ff8000000000000ull
+#define null_value    ((Value)0x02)
+
+#define isnull(_v)     ((_v) == null_value)
+#define isnumber(_v)   ((_v) >= NUMBER_OFFSET)
+#define isobject(_v)   (!isnumber(_v) && !isnull(_v))
+#define as_object(_v)  ((Object*)(uintptr_t)(_v))
+#define object_value(_o) ((Value)(uintptr_t)(_o))
+
+#define isobjectkind(_v, _kind) (isobject(_v) && as_object(_v)->kind == (_kind))
+#define isstring(_v)   isobjectkind(_v, VALUE_STRING)
+#define istable(_v)    isobjectkind(_v, VALUE_TABLE)
+#define isfunction(_v) isobjectkind(_v, VALUE_FUNCTION)
+#define isuserdata(_v) isobjectkind(_v, VALUE_USERDATA)
+
+#define as_string(_v)   (as_object(_v)->string.str)
+#define as_function(_v) (as_object(_v)->func)
+
+Value make_number_value(Ir *ir, double n) {
+	uint64_t bits = CANONICAL_NAN;
+	if (n == n) {
+		memcpy(&bits, &n, sizeof(double));
+	}
+	return bits + NUMBER_OFFSET;
+}
+
+double as_number(Value v) {
+	uint64_t bits = v - NUMBER_OFFSET;
+	double n;
+	memcpy(&n, &bits, sizeof(double));
+	return n;
+}
+
+// Hidden classes for the string keys of a table. Tables that got the same
+// keys added in the same order share a shape, which says at what index in
+// Object.table.fields each key lives. Shapes form a tree through their
+// transitions and are never freed, so only immortal keys, the names written
+// in the program, get one. Any other string key puts the table in
+// dictionary mode, otherwise every computed key would leak a shape.
+typedef struct Shape Shape;
+struct Shape {
+	Shape *parent;
+	Value key;          // Immortal string added by this shape, 0 for the root
+	uint32_t count;     // Number of fields, key lives at fields[count-1]
+	Map transitions;    // Key -> child Shape*
+	Map index;          // Key -> index + 1, built on first lookup in big shapes
+};
+
+// Past this many fields a table moves its string keys into the map
+#define SHAPE_MAX_FIELDS 64
+// Shapes with more fields than this look keys up through Shape.index
+// instead of walking the parents
+#define SHAPE_SCAN_LIMIT 8
+
+// Remembers where the last few shapes seen at a field access or method call
+// keep the field. One way is monomorphic, the rest make it polymorphic.
+#define IC_WAYS 4
+typedef struct InlineCache {
+	Shape *shapes[IC_WAYS];
+	uint32_t slots[IC_WAYS];
+	Shape *add_from; // Stores that add the field go from this shape
+	Shape *add_to;   // to this one
+} InlineCache;
+
+// Table constructors that only have positional and name = v entries, with
+// no name repeated, are built in one go from a template made when the
+// constructor is converted or compiled
+#define TEMPLATE_ARRAY       UINT32_MAX
+#define TEMPLATE_MAX_ENTRIES 128
+typedef struct TableTemplate {
+	Shape *shape;          // Shape once every name = v entry is stored
+	uint32_t array_count;  // Positional entries
+	Array(uint32_t) slots; // Per entry in order, its field index or TEMPLATE_ARRAY
+} TableTemplate;
+void free_table_template(TableTemplate *template);
+
+// Heap objects, only runtime values live here so they stay small
+struct Object {
 	GCObject gc;
 	ValueKind kind;
 
 	union {
-		struct {
-			double value;
-		} number;
 		struct {
 			String str;
+			uint64_t hash; // Strings are interned, so this is computed once
 		} string;
 		struct {
-			Map map;
+			Shape *shape;       // 0 once the table is in dictionary mode
+			Value *fields;      // String keys as laid out by shape
+			Map map;            // Everything that is not in the array part or fields
+			Value *array;       // Keys 0 to array_len-1, holes are null
+			uint32_t array_len;
+			uint32_t array_cap;
 		} table;
+		Function *func; // Out of line, it is by far the biggest kind
 		struct {
-			TableEntryArray entries;
-		} table_constant;
-		Function func;
+			void *data;
+		} userdata;
+		Object *forwarded;
+	};
+};
+
+ValueKind value_kind(Value v) {
+	if (isnumber(v)) return VALUE_NUMBER;
+	if (isnull(v)) return VALUE_NULL;
+	return as_object(v)->kind;
+}
+
+// Tree walker expressions, these never change after being converted from the
+// ast. Literals including strings and anonymous functions are EXPR_CONSTANT.
+typedef enum ExprKind {
+	EXPR_CONSTANT,
+	EXPR_TABLE,
+	EXPR_BINOP,
+	EXPR_UNARY,
+	EXPR_NAME,
+	EXPR_INDEX,
+	EXPR_CALL,
+	EXPR_METHOD_CALL,
+	EXPR_FIELD,
+	EXPR_INCDEC,
+} ExprKind;
+
+// A table constructor entry, key is set for ENTRY_INDEX and ENTRY_KEY,
+// where it is a string constant
+typedef struct ExprTableEntry {
+	TableEntryKind kind;
+	Expr *key;
+	Expr *expr;
+} ExprTableEntry;
+
+struct Expr {
+	ExprKind kind;
+
+	union {
+		struct {
+			Value value;
+		} constant;
+		struct {
+			Array(ExprTableEntry) entries;
+			TableTemplate *template; // 0 if the constructor can not use one
+			uint32_t array_count;    // Positional entries, to presize the array part
+		} table;
 		struct {
 			TokenKind op;
-			Value *lhs;
-			Value *rhs;
+			Expr *lhs;
+			Expr *rhs;
 		} binary;
 		struct {
 			TokenKind op;
-			Value *v;
+			Expr *v;
 		} unary;
 		struct {
 			String name;
+			bool local;  // Slot is in the frame, otherwise it is an index into globals
+			size_t slot;
 		} name;
 		struct {
-			Value *expr;
-			Value *index;
+			Expr *expr;
+			Expr *index;
 		} index;
 		struct {
-			Value *expr;
-			ValueArray args;
+			Expr *expr;
+			ExprArray args;
 		} call;
 		struct {
-			Value *expr;
-			String name;
+			Expr *expr;
+			Value name; // Interned string
+			InlineCache *cache;
 		} field;
 		struct {
-			Value *expr;
-			String name;
-			ValueArray args;
+			Expr *expr;
+			Value name;
+			InlineCache *cache;
+			ExprArray args;
 		} method_call;
 		struct {
-			void *data;
-		} userdata;
-		struct {
-			Value *expr;
+			Expr *expr;
 			TokenKind op;
 			bool post;
 		} incdec;
 	};
 };
-Value *null_value = &(Value) { .kind = VALUE_NULL };
 
 typedef enum StmtKind {
 	STMT_VAR,
@@ -175,30 +302,31 @@ typedef enum StmtKind {
 } StmtKind;
 
 struct Stmt {
-	GCObject gc;
 	StmtKind kind;
 	SourceLoc loc;
 
 	union {
 		struct {
 			String name;
-			Value *expr;
+			size_t slot;
+			Expr *expr;
 		} var;
 		struct {
-			Value *left;
-			Value *right;
+			Expr *left;
+			Expr *right;
 		} assign;
 		struct {
-			Value *expr;
+			Expr *expr;
 		} ret;
 		struct {
-			Value *expr;
-			ValueArray args;
+			Expr *expr;
+			ExprArray args;
 		} call;
 		struct {
-			Value *expr;
-			String name;
-			ValueArray args;
+			Expr *expr;
+			Value name;
+			InlineCache *cache;
+			ExprArray args;
 		} method_call;
 		struct {
 			int unused;
@@ -207,183 +335,286 @@ struct Stmt {
 			int unused;
 		} _continue;
 		struct {
-			Value *cond;
+			Expr *cond;
 			Stmt* if_block;
 			Stmt* else_block;
 		} _if;
 		struct {
-			Value *cond;
+			Expr *cond;
 			Stmt *block;
 		} _while;
 		struct {
 			StmtArray stmts;
 		} block;
 		struct {
-			Value *expr;
+			Expr *expr;
 			TokenKind op;
 		} incdec;
 	};
 };
 
+// The callee is kept alive by its slot on the value stack, so only a
+// pointer is needed for the stack trace
 typedef struct StackCall {
-	SourceLoc loc;
-	String name;
-	FunctionKind kind;
+	Function *func;
 } StackCall;
 typedef Array(StackCall) CallStack;
 
-typedef Array(Scope*) ScopeStack;
 struct Ir {
 	SourceLoc loc;
-	Scope *global_scope;
-	Scope *file_scope;
+	ValueArray globals;       // Builtins and top level definitions, 0 until defined
+	StringArray global_names;
+	Map global_slots;         // Name -> index + 1 into globals
+	Map strings;              // Every live string object, keyed by contents. Weak, see gc_clear_dead_strings
+	Map literals;             // Tree walker EXPR_CONSTANT for each distinct literal value
+	size_t immortal_count;
 	CallStack callstack;
-	ScopeStack scope_stack;
-
-	Pool value_pool;
-	Pool scope_pool;
-	Pool stmt_pool;
-
-	GCObject *white_list;
-	GCObject *grey_list;
-	GCObject *black_list;
-
-	int allocated_values;
-	int max_allocated_values;
+	Resolver *resolver;       // Locals of the function being converted for the tree walker
+
+	Pool object_pool;
+	Arena code;               // Stmts and Exprs, never collected, see alloc_stmt
+	Heap heap;                // Strings and the storage of tables, see gc_object_size
+
+	Array(GCObject*) grey_stack;    // Marked old objects left to scan
+
+	// Generations. New objects go in the nursery and are only traced by minor
+	// collections, major collections only mark and sweep old objects.
+	Array(GCObject*) young;         // Allocated since the last minor collection
+	size_t young_bytes;
+	Array(GCObject*) remembered;    // Old objects that may point into the nursery
+	Array(GCObject*) minor_stack;   // Promoted objects left to scan
+	bool in_minor_gc;
+	bool gc_marking; // A major cycle has marked the roots and not swept yet
+	uint64_t minor_collections;
+	uint64_t major_collections;
+
+	uint64_t allocated_values; // Objects allocated over the whole run
+	int64_t gc_debt; // Bytes allocated that the gc has not yet paid for by marking
+	int gc_step_mul; // Percent of the debt each step scans, see gc_step
+	int gc_pause;    // Percent the live heap grows by before the next cycle scans
+	size_t gc_marked; // Bytes scanned so far this cycle
+	long long gc_mark_time; // Spent in major marking, in time_stamp_freq units
+
+	// What the collector has done so far, see gc_stats in runtime.c and -gcstats
+	uint64_t gc_minor_freed;        // Objects freed by minor collections
+	uint64_t gc_minor_freed_bytes;
+	uint64_t gc_major_freed;        // Objects freed by finished major sweeps
+	uint64_t gc_major_freed_bytes;
+	uint64_t gc_last_freed;         // By the last finished major sweep
+	uint64_t gc_last_freed_bytes;
+	uint64_t gc_swept;              // By the running sweep, only touched by whoever is sweeping
+	uint64_t gc_swept_bytes;
+	long long gc_sweep_time;        // Including the sweeper thread, in time_stamp_freq units
+	long long gc_max_pause;         // Longest single gc_step
+
+	// With more than one thread each major cycle is marked in one go by
+	// workers that steal from each other, see gc_mark_parallel
+	int gc_threads;
+	GCWorker *gc_workers;
+	volatile long gc_idle_workers;
+
+	// Old buckets are swept on their own thread after each major cycle, see
+	// gc_sweep_pools
+	Thread gc_sweeper;
+	bool gc_sweeping;
+	volatile long gc_sweep_done;
+
+	// Sparse buckets are evacuated at the start of a cycle, see gc_compact
+	bool gc_compact;
+	int vm_depth; // Nested vm_execute calls, natives in between keep values in C locals
+	uint64_t compactions;
+	uint64_t objects_moved;
 	bool do_gc;
+
+	Shape *root_shape;        // Shape of an empty table
+	Array(Shape*) shapes;     // Every shape
+	uint64_t ic_hits;
+	uint64_t ic_misses;
+	uint64_t tail_calls;      // Calls in return position that reused the caller's frame
+
+	// Set by a tree walker 'return f(...)', eval_function then replaces the
+	// current call with the one whose callee and arguments start here
+	Value *tail_call;
+	size_t tail_argc;
+	bool tail_is_method_call;
+
+	bool dump_ir; // Print imported files after optimize()
+
+	// Bytecode VM, see vm.c
+	bool use_tree_walker;
+	Value *stack;
+	Value *stack_top;
+	CallFrame *frames;
+	size_t frame_count;
+	CallFrame *frame; // Currently executing frame, 0 outside of the VM
 };
 
+#define VM_STACK_SIZE (1 << 16)
+// Every call keeps at least its callee on the stack, so with one frame per
+// slot recursion runs out of stack before it runs out of frames
+#define VM_MAX_FRAMES VM_STACK_SIZE
+
 void print_stacktrace(Ir *ir) {
-	assert(ir->callstack.size);
-	
+	// Errors found while resolving happen before main is called
+	if (ir->callstack.size == 0) return;
+
 	for (int i = (int)ir->callstack.size - 1; i >= 0; i--) {
 	//for (int i = 0; i < (int)ir->callstack.size; i++) {
-		StackCall *c = &ir->callstack.data[i];
+		Function *f = ir->callstack.data[i].func;
 		char *type = "";
-		if (c->kind == FUNCTION_NATIVE) {
+		if (f->kind == FUNCTION_NATIVE) {
 			type = "native:";
 		}
-		else if (c->kind == FUNCTION_FFI) {
+		else if (f->kind == FUNCTION_FFI) {
 			type = "ffi:";
 		}
-		printf("    %s%.*s() - %.*s:(%d)\n", type, (int)c->name.len, c->name.str, (int)c->loc.file.len, c->loc.file.str, (int)c->loc.line);
+		printf("    %s%.*s() - %.*s:(%d)\n", type, (int)f->name.len, f->name.str, (int)f->loc.file.len, f->loc.file.str, (int)f->loc.line);
 	}
 }
 
-void push_call(Ir *ir, StackCall call) {
+void push_call(Ir *ir, Function *func) {
+	StackCall call = { func };
 	array_add(ir->callstack, call);
 }
 
 void pop_call(Ir *ir) {
 	ir->callstack.size--;
-	StackCall *call = &ir->callstack.data[ir->callstack.size];
-	free(call->name.str);
 }
 
-typedef struct Scope Scope;
-struct Scope {
-	GCObject gc;
-	Scope *parent;
-	Map symbols; // char*, Value*
-};
-
-Scope* alloc_scope(Ir *ir) {
-	Scope *scope = pool_alloc(&ir->scope_pool);
-	
-	scope->gc.gc_kind = GC_SCOPE;
-	scope->gc.color = GC_GREY;
-	scope->gc.next = ir->grey_list;
-	scope->gc.prev = 0;
-	ir->grey_list = (GCObject*)scope;
-
-	return scope;
+// Calls push the callee and then the arguments onto the value stack, so
+// arguments are passed in place and stay reachable for the gc. Returns
+// where the callee went, reset stack_top to it after the call.
+Value* push_callee(Ir *ir, Value func, size_t argc) {
+	Value *base = ir->stack_top;
+	if (base + 1 + argc > ir->stack + VM_STACK_SIZE) {
+		ir_error(ir, "Stack overflow!");
+	}
+	*ir->stack_top++ = func;
+	return base;
 }
 
-void free_scope(Ir *ir, Scope *scope) {
-	pool_release(&ir->scope_pool, scope);
+// The tree walker keeps values it holds in C locals here while it evaluates
+// further expressions, those can run statements and with them the collector
+void push_temp(Ir *ir, Value v) {
+	if (ir->stack_top >= ir->stack + VM_STACK_SIZE) {
+		ir_error(ir, "Stack overflow!");
+	}
+	*ir->stack_top++ = v;
 }
 
-/*
-Scope* make_scope_no_gc(Ir *ir, Scope *parent) {
-	Scope *scope = calloc(1, sizeof(Scope));
-
-	scope->parent = parent;
-
-	return scope;
+// Errors unless a variable currently holding old may be assigned to
+void check_assign(Ir *ir, Value old) {
+	switch (value_kind(old)) {
+	case VALUE_NULL:
+	case VALUE_STRING:
+	case VALUE_NUMBER:
+	case VALUE_TABLE: {
+	} break;
+	case VALUE_FUNCTION: {
+		ir_error(ir, "Cannot assign to a function!");
+	} break;
+	default: {
+		ir_error(ir, "Cannot assign to symbol!");
+	}break;
+	}
 }
-*/
-
-Scope* make_scope(Ir *ir, Scope *parent) {
-	Scope *scope = alloc_scope(ir);
 
-	scope->parent = parent;
+// Returns the index of a global, giving it an undefined slot if it has none yet
+size_t global_slot(Ir *ir, String name) {
+	uint64_t slot = map_get_string(&ir->global_slots, name);
+	if (slot) return slot - 1;
 
-	return scope;
+	array_add(ir->globals, 0);
+	array_add(ir->global_names, make_string_copy(name));
+	map_put_string(&ir->global_slots, name, ir->globals.size);
+	return ir->globals.size - 1;
 }
 
-Scope* push_scope(Ir *ir, Scope *parent) {
-	Scope *scope = make_scope(ir, parent);
-	array_add(ir->scope_stack, scope);
-	return scope;
+void global_add(Ir *ir, String name, Value v) {
+	size_t slot = global_slot(ir, name);
+	if (ir->globals.data[slot]) {
+		ir_error(ir, "Symbol '%.*s' already exists in this scope!", (int)name.len, name.str);
+	}
+	ir->globals.data[slot] = v;
 }
 
-void pop_scope(Ir *ir) {
-	assert(ir->scope_stack.size > 0);
-	ir->scope_stack.size--;
+// Builtins are added after the top level code, so scripts can shadow them
+void global_add_builtin(Ir *ir, String name, Value v) {
+	size_t slot = global_slot(ir, name);
+	if (!ir->globals.data[slot]) {
+		ir->globals.data[slot] = v;
+	}
 }
 
-// Gets a symbol traveling up through the scope to find it
-Value* scope_get(Ir *ir, Scope *scope, String name) {
-	Value *v = map_get_string(&scope->symbols, name);
+Value global_get(Ir *ir, size_t slot) {
+	Value v = ir->globals.data[slot];
 	if (!v) {
-		if (scope->parent) {
-			return scope_get(ir, scope->parent, name);
-		}
-		else {
-			ir_error(ir, "Symbol '%.*s' does not exist.", (int)name.len, name.str);
-		}
+		String name = ir->global_names.data[slot];
+		ir_error(ir, "Symbol '%.*s' does not exist.", (int)name.len, name.str);
 	}
 	return v;
 }
 
-// Adds to current 
-void scope_add(Ir* ir, Scope *scope, String name, Value *v) {
-	Value *test = map_get_string(&scope->symbols, name);
-	if (test) {
-		ir_error(ir, "Symbol '%.*s' already exists in this scope!", (int)name.len, name.str);
-	}
-	else {
-		map_put_string(&scope->symbols, name, v);
-	}
+void global_set(Ir *ir, size_t slot, Value v) {
+	check_assign(ir, global_get(ir, slot));
+	ir->globals.data[slot] = v;
 }
 
-// Updates a symbol, seach up through the scope
-void scope_set(Ir* ir, Scope *scope, String name, Value *v) {
-	Value *test = map_get_string(&scope->symbols, name);
-	if (test) {
-		switch (test->kind) {
-		case VALUE_NULL:
-		case VALUE_STRING:
-		case VALUE_NUMBER:
-		case VALUE_TABLE: {
-			map_put_string(&scope->symbols, name, v);
-		} break;
-		case VALUE_FUNCTION: {
-			ir_error(ir, "Cannot assign to a function!");
-		} break;
-		default: {
-			ir_error(ir, "Cannot assign to symbol!");
-		}break;
+// Locals of the function being converted or compiled. A local's index is its
+// slot in the frame, blocks hand their slots back when they end. Names that
+// are not locals are globals, there are no closures.
+typedef struct Local {
+	String name;
+	int depth;
+} Local;
+
+struct Resolver {
+	Array(Local) locals;
+	int depth;
+	size_t frame_size; // Most locals alive at once
+};
+
+size_t declare_local(Ir *ir, Resolver *r, String name) {
+	for (size_t i = r->locals.size; i > 0 && r->locals.data[i - 1].depth == r->depth; i--) {
+		if (strings_match(r->locals.data[i - 1].name, name)) {
+			ir_error(ir, "Symbol '%.*s' already exists in this scope!", (int)name.len, name.str);
 		}
 	}
-	else {
-		if (scope->parent) {
-			scope_set(ir, scope->parent, name, v);
-		}
-		else {
-			ir_error(ir, "Symbol '%*.s' does not exist.", (int)name.len, name.str);
+	Local local = { name, r->depth };
+	array_add(r->locals, local);
+	r->frame_size = max(r->frame_size, r->locals.size);
+	return r->locals.size - 1;
+}
+
+// Returns the slot of the innermost local called name or -1
+int resolve_local(Resolver *r, String name) {
+	for (size_t i = r->locals.size; i > 0; i--) {
+		if (strings_match(r->locals.data[i - 1].name, name)) {
+			return (int)(i - 1);
 		}
 	}
+	return -1;
+}
+
+// How many locals are deeper than depth
+size_t count_locals_above(Resolver *r, int depth) {
+	size_t count = 0;
+	for (size_t i = r->locals.size; i > 0 && r->locals.data[i - 1].depth > depth; i--) {
+		count++;
+	}
+	return count;
+}
+
+void begin_scope(Resolver *r) {
+	r->depth++;
+}
+
+// Returns how many locals went out of scope
+size_t end_scope(Resolver *r) {
+	r->depth--;
+	size_t count = count_locals_above(r, r->depth);
+	r->locals.size -= count;
+	return count;
 }
 
 #ifdef _WIN32
@@ -392,6 +623,7 @@ __declspec(noreturn)
 __attribute__((noreturn))
 #endif
 void ir_error(Ir *ir, char *format, ...) {
+	vm_locate(ir);
 	printf("%s(%lld, %lld): ", ir->loc.file.str, ir->loc.line, ir->loc.offset);
 	va_list args;
 	va_start(args, format);
@@ -409,24 +641,19 @@ void ir_error(Ir *ir, char *format, ...) {
 	exit(1);
 }
 
-uint64_t hash_value(Ir *ir, Value *v) {
-	switch (v->kind) {
-	case VALUE_NULL: return hash_ptr(null_value); //TODO: This is constant, we only need to hash this ptr once
+uint64_t hash_value(Ir *ir, Value v) {
+	switch (value_kind(v)) {
+	case VALUE_NULL: return hash_uint64(null_value); //TODO: This is constant, we only need to hash it once
 	case VALUE_NUMBER: {
-		uint64_t num = 0;
-		assert(sizeof(uint64_t) == sizeof(double));
-		memcpy(&num, &v->number.value, sizeof(uint64_t));
-		return hash_uint64(num);
+		// Hash the double rather than the boxed bits so keys match the old hashes
+		return hash_uint64(v - NUMBER_OFFSET);
 	}
 	case VALUE_STRING: {
-		return hash_bytes(v->string.str.str, v->string.str.len);
+		return as_object(v)->string.hash;
 	}
 	case VALUE_TABLE: {
 		ir_error(ir, "A table cannot be used as an index");
 	}
-	case VALUE_NAME: {
-		return hash_bytes(v->name.name.str, v->name.name.len);
-	}
 	default: {
 		assert(!"Unimplemented hash_value case");
 		exit(1);
@@ -434,249 +661,445 @@ uint64_t hash_value(Ir *ir, Value *v) {
 	}
 }
 
-void table_put(Ir *ir, Value *table, Value *key, Value *val) {
-	assert(table);
-	assert(key);
-	assert(val);
+// Memory an object owns outside of its pool slot is paid for by the
+// generation the object is in
+void gc_add_owned(Ir *ir, Object *obj, size_t bytes) {
+	if (obj->gc.gc_flags & GC_YOUNG) {
+		ir->young_bytes += bytes;
+	}
+	else {
+		ir->gc_debt += bytes;
+	}
+}
 
-	map_put_hash(&table->table.map, hash_value(ir, key), val);
+// Moves storage owned by t to a block of at least size bytes
+void* table_realloc(Ir *ir, Object *t, void *ptr, size_t size) {
+	size_t old_size = ptr ? heap_size(ptr) : 0;
+	ptr = heap_realloc(&ir->heap, ptr, size);
+	gc_add_owned(ir, t, heap_size(ptr) - old_size);
+	return ptr;
 }
 
-void table_put_name(Ir *ir, Value *table, String name, Value *val) {
-	assert(table);
-	assert(val);
+// The map of a table lives in the heap, so it is grown here rather than by
+// map_insert
+void table_insert(Ir *ir, Object *t, uint64_t hash, Value key, Value val) {
+	Map *map = &t->table.map;
+	size_t cap = map_grow_cap(map);
+	if (cap) {
+		size_t old_size = map->entries ? heap_size(map->entries) : 0;
+		MapEntry *entries = heap_alloc(&ir->heap, map_alloc_size(cap));
+		heap_free(&ir->heap, map_rehash(map, entries, cap));
+		gc_add_owned(ir, t, heap_size(entries) - old_size);
+	}
+	map_insert(map, hash, key, val);
+}
 
-	map_put_hash(&table->table.map, hash_bytes(name.str, name.len), val);
+// Returns where key would go in the array part, or -1 if key is not a
+// non-negative integer
+int64_t table_array_index(Value key) {
+	if (!isnumber(key)) return -1;
+	double d = as_number(key);
+	if (!(d >= 0 && d < (double)UINT32_MAX)) return -1;
+	int64_t i = (int64_t)d;
+	return (double)i == d ? i : -1;
 }
 
-Value* table_get(Ir *ir, Value *table, Value *key) {
-	uint64_t hash = hash_value(ir, key);
-	return map_get(&table->table.map, hash);
+void table_array_push(Ir *ir, Object *t, Value val) {
+	if (t->table.array_len == t->table.array_cap) {
+		uint32_t cap = t->table.array_cap ? 2 * t->table.array_cap : 4;
+		t->table.array = table_realloc(ir, t, t->table.array, cap * sizeof(Value));
+		t->table.array_cap = cap;
+	}
+	t->table.array[t->table.array_len++] = val;
+}
+
+// The hash part never holds the key array_len, so after appending we pull
+// in any keys that now continue the array
+void table_array_migrate(Ir *ir, Object *t) {
+	Map *map = &t->table.map;
+	while (map->len > 0) {
+		Value key = make_number_value(ir, (double)t->table.array_len);
+		MapEntry *e = map_find(map, hash_value(ir, key), 0, &key);
+		if (!e) break;
+		table_array_push(ir, t, e->val);
+		map_remove(map, e);
+	}
 }
 
-Value* table_get_name(Ir *ir, Value *table, String name) {
-	uint64_t hash = hash_bytes(name.str, name.len);
-	return map_get(&table->table.map, hash);
+Shape* make_shape(Ir *ir, Shape *parent, Value key) {
+	Shape *shape = calloc(1, sizeof(Shape));
+	shape->parent = parent;
+	shape->key = key;
+	shape->count = parent ? parent->count + 1 : 0;
+	array_add(ir->shapes, shape);
+	return shape;
 }
 
-Value* alloc_value(Ir *ir) {
-	Value *v = pool_alloc(&ir->value_pool);
-	ir->allocated_values++;
+// Returns the index of key in the fields of a table with this shape, or -1
+int64_t shape_find(Shape *shape, Value key) {
+	if (shape->count > SHAPE_SCAN_LIMIT) {
+		if (shape->index.len == 0) {
+			for (Shape *s = shape; s->key; s = s->parent) {
+				map_insert(&shape->index, as_object(s->key)->string.hash, s->key, s->count);
+			}
+		}
+		MapEntry *e = map_find(&shape->index, as_object(key)->string.hash, 0, &key);
+		return e ? (int64_t)e->val - 1 : -1;
+	}
 
-	v->gc.gc_kind = GC_VALUE;
-	v->gc.color = GC_GREY;
-	v->gc.next = ir->grey_list;
-	v->gc.prev = 0;
-	ir->grey_list = (GCObject*)v;
+	for (Shape *s = shape; s->key; s = s->parent) {
+		if (s->key == key) return s->count - 1;
+	}
+	return -1;
+}
 
-	return v;
+Shape* shape_add(Ir *ir, Shape *shape, Value key) {
+	uint64_t hash = as_object(key)->string.hash;
+	MapEntry *e = map_find(&shape->transitions, hash, 0, &key);
+	if (e) return (Shape*)(uintptr_t)e->val;
+
+	Shape *child = make_shape(ir, shape, key);
+	map_insert(&shape->transitions, hash, key, (uint64_t)(uintptr_t)child);
+	return child;
 }
 
-void free_value(Ir *ir, Value *v) {
-	pool_release(&ir->value_pool, v);
+// Fields are allocated in powers of two from 4, so the capacity follows from
+// the shape and does not have to be stored
+size_t table_fields_cap(Shape *shape) {
+	if (!shape || shape->count == 0) return 0;
+	size_t cap = 4;
+	while (cap < shape->count) cap *= 2;
+	return cap;
 }
 
-void gc_mark(Ir *ir) {
-	if (ir->global_scope && ir->global_scope->symbols.cap > 0) {
-		for (size_t i = 0; i < ir->global_scope->symbols.cap; i++) {
-			MapEntry *e = &ir->global_scope->symbols.entries[i];
-			if (e->hash) {
-				Value *v = e->val;
-				gc_add_to_grey(ir, (GCObject*)v);
+// child has to be the transition from the current shape of t
+void table_add_field(Ir *ir, Object *t, Shape *child, Value val) {
+	size_t cap = table_fields_cap(t->table.shape);
+	uint32_t index = t->table.shape->count;
+	if (index == cap) {
+		size_t new_cap = cap ? 2 * cap : 4;
+		t->table.fields = table_realloc(ir, t, t->table.fields, new_cap * sizeof(Value));
+	}
+	t->table.fields[index] = val;
+	t->table.shape = child;
+}
+
+// Moves the fields into the map, for tables that delete string keys or
+// have too many of them for shapes to pay off
+void table_to_dictionary(Ir *ir, Object *t) {
+	for (Shape *s = t->table.shape; s->key; s = s->parent) {
+		table_insert(ir, t, as_object(s->key)->string.hash, s->key, t->table.fields[s->count - 1]);
+	}
+	heap_free(&ir->heap, t->table.fields);
+	t->table.fields = 0;
+	t->table.shape = 0;
+}
+
+// Assigning null removes the key, which leaves a tombstone in the map. In the
+// array part it leaves a hole, unless it is at the end where it shrinks it.
+void table_put(Ir *ir, Value table, Value key, Value val) {
+	assert(istable(table));
+	assert(key);
+	assert(val);
+
+	Object *t = as_object(table);
+	gc_write_barrier(ir, t, key);
+	gc_write_barrier(ir, t, val);
+	int64_t index = table_array_index(key);
+	if (index >= 0 && index <= t->table.array_len) {
+		if (index < t->table.array_len) {
+			t->table.array[index] = val;
+			while (t->table.array_len > 0 && isnull(t->table.array[t->table.array_len - 1])) {
+				t->table.array_len--;
 			}
 		}
+		else if (!isnull(val)) {
+			table_array_push(ir, t, val);
+			table_array_migrate(ir, t);
+		}
+		return;
 	}
-	if (ir->file_scope && ir->file_scope->symbols.cap > 0) {
-		for (size_t i = 0; i < ir->file_scope->symbols.cap; i++) {
-			MapEntry *e = &ir->file_scope->symbols.entries[i];
-			if (e->hash) {
-				Value *v = e->val;
-				gc_add_to_grey(ir, (GCObject*)v);
+
+	if (t->table.shape && isstring(key)) {
+		int64_t slot = shape_find(t->table.shape, key);
+		if (slot >= 0 && !isnull(val)) {
+			t->table.fields[slot] = val;
+			return;
+		}
+		if (slot < 0) {
+			if (isnull(val)) return;
+			bool immortal = as_object(key)->gc.gc_flags & GC_IMMORTAL;
+			if (immortal && t->table.shape->count < SHAPE_MAX_FIELDS) {
+				table_add_field(ir, t, shape_add(ir, t->table.shape, key), val);
+				return;
 			}
 		}
+		table_to_dictionary(ir, t);
 	}
-	if (ir->scope_stack.size > 0) {
-		Scope *scope;
-		for_array(ir->scope_stack, scope) {
-			gc_add_to_grey(ir, (GCObject*) scope);
-		}
+
+	Map *map = &t->table.map;
+	uint64_t hash = hash_value(ir, key);
+	MapEntry *e = map_find(map, hash, 0, &key);
+	if (e) {
+		if (isnull(val)) map_remove(map, e);
+		else e->val = val;
+	}
+	else if (!isnull(val)) {
+		table_insert(ir, t, hash, key, val);
 	}
 }
 
-void gc_remove_from_specific_list(GCObject **list, GCObject *obj) {
-	if (obj->prev) {
-		obj->prev->next = obj->next;
-		if (obj->next) {
-			obj->next->prev = obj->prev;
+// Natives only pass names written in their source, so these become literals
+// and can go in shapes
+void table_put_name(Ir *ir, Value table, String name, Value val) {
+	table_put(ir, table, make_literal(ir, intern_string(ir, name)), val);
+}
+
+// Returns 0 if the key does not exist
+Value table_get(Ir *ir, Value table, Value key) {
+	Object *t = as_object(table);
+	if (isnumber(key) && t->table.array_len > 0) {
+		int64_t index = table_array_index(key);
+		if (index >= 0 && index < t->table.array_len) {
+			return t->table.array[index];
 		}
-		obj->prev = 0;
-		obj->next = 0;
 	}
-	else {
-		*list = obj->next;
-		if (obj->next) {
-			obj->next->prev = 0;
-			if ((*list)->next) {
-				(*list)->next->prev = *list;
+	if (t->table.shape && isstring(key)) {
+		int64_t slot = shape_find(t->table.shape, key);
+		return slot >= 0 ? t->table.fields[slot] : 0;
+	}
+
+	uint64_t hash = hash_value(ir, key);
+	MapEntry *e = map_find(&as_object(table)->table.map, hash, 0, &key);
+	return e ? e->val : 0;
+}
+
+void cache_add(InlineCache *cache, Shape *shape, uint32_t slot) {
+	// Newest first, the oldest way falls off the end
+	for (int i = IC_WAYS - 1; i > 0; i--) {
+		cache->shapes[i] = cache->shapes[i - 1];
+		cache->slots[i] = cache->slots[i - 1];
+	}
+	cache->shapes[0] = shape;
+	cache->slots[0] = slot;
+}
+
+// table_get for a field access or method call site with a constant name
+Value table_get_cached(Ir *ir, Value table, Value name, InlineCache *cache) {
+	Object *t = as_object(table);
+	Shape *shape = t->table.shape;
+	if (shape) {
+		for (int i = 0; i < IC_WAYS; i++) {
+			if (cache->shapes[i] == shape) {
+				ir->ic_hits++;
+				return t->table.fields[cache->slots[i]];
 			}
 		}
-		obj->next = 0;
-		obj->prev = 0;
 	}
+	ir->ic_misses++;
+
+	if (shape) {
+		int64_t slot = shape_find(shape, name);
+		if (slot < 0) return 0;
+		cache_add(cache, shape, (uint32_t)slot);
+		return t->table.fields[slot];
+	}
+	return table_get(ir, table, name);
 }
 
-void gc_remove_from_list(Ir *ir, GCObject *obj) {
-	switch (obj->color) {
-	case GC_WHITE: {
-		gc_remove_from_specific_list(&ir->white_list, obj);
-	} break;
-	case GC_GREY: {
-		gc_remove_from_specific_list(&ir->grey_list, obj);
-	} break;
-	case GC_BLACK: {
-		gc_remove_from_specific_list(&ir->black_list, obj);
-	} break;
-	default: {
-		assert(!"Invalid color!");
+// Stores to existing fields use the same ways as table_get_cached, stores
+// that add the field remember the one transition they saw last
+void table_put_cached(Ir *ir, Value table, Value name, Value val, InlineCache *cache) {
+	Object *t = as_object(table);
+	Shape *shape = t->table.shape;
+	if (shape && !isnull(val)) {
+		gc_write_barrier(ir, t, val);
+		for (int i = 0; i < IC_WAYS; i++) {
+			if (cache->shapes[i] == shape) {
+				ir->ic_hits++;
+				t->table.fields[cache->slots[i]] = val;
+				return;
+			}
+		}
+		if (cache->add_from == shape) {
+			ir->ic_hits++;
+			table_add_field(ir, t, cache->add_to, val);
+			return;
+		}
+	}
+	ir->ic_misses++;
+
+	table_put(ir, table, name, val);
+	if (shape && t->table.shape == shape) {
+		int64_t slot = shape_find(shape, name);
+		if (slot >= 0) cache_add(cache, shape, (uint32_t)slot);
 	}
+	else if (shape && t->table.shape && t->table.shape->parent == shape) {
+		cache->add_from = shape;
+		cache->add_to = t->table.shape;
 	}
+}
 
-	
+// A name that was never interned cannot be a key, so this never allocates
+Value table_get_name(Ir *ir, Value table, String name) {
+	Value key = find_interned_string(ir, name);
+	return key ? table_get(ir, table, key) : 0;
 }
 
-void gc_add_to_grey(Ir *ir, GCObject *obj) {
-	if (obj->color == GC_BLACK || obj->color == GC_GREY) return;
-	gc_remove_from_list(ir, obj);
-	obj->color = GC_GREY;
-	obj->next = ir->grey_list;
-	if (obj->next) {
-		obj->next->prev = obj;
-	}
-	obj->prev = 0;
-	ir->grey_list = obj;
+// New objects start out in the nursery
+void gc_add_young(Ir *ir, GCObject *obj, GCKind kind, size_t size) {
+	ir->young_bytes += size;
+
+	obj->gc_kind = kind;
+	obj->gc_flags = GC_YOUNG;
+	array_add(ir->young, obj);
 }
 
-void gc_add_to_black(Ir *ir, GCObject *obj) {
-	gc_remove_from_list(ir, obj);
-	obj->color = GC_BLACK;
-	obj->next = ir->black_list;
-	if (obj->next) {
-		obj->next->prev = obj;
-	}
-	obj->prev = 0;
-	ir->black_list = obj;
+Object* alloc_object(Ir *ir, ValueKind kind) {
+	Object *obj = pool_alloc(&ir->object_pool);
+	ir->allocated_values++;
+	gc_add_young(ir, (GCObject*)obj, GC_OBJECT, sizeof(Object));
+
+	obj->kind = kind;
+	return obj;
 }
 
-void gc_mark_value(Ir *ir, Value *value);
-void gc_mark_stmt(Ir *ir, Stmt *stmt) {
-	if (stmt->gc.color == GC_BLACK) return;
-	gc_add_to_black(ir, (GCObject*)stmt);
+void free_object(Ir *ir, Object *obj) {
+	pool_release(&ir->object_pool, obj);
+}
 
-	switch (stmt->kind) {
-	case STMT_VAR: {
-		gc_add_to_grey(ir, (GCObject*) stmt->var.expr);
-	} break;
-	case STMT_ASSIGN: {
-		gc_add_to_grey(ir, (GCObject*)stmt->assign.left);
-		gc_add_to_grey(ir, (GCObject*)stmt->assign.right);
-	} break;
-	case STMT_RETURN: {
-		if (stmt->ret.expr) {
-			gc_add_to_grey(ir, (GCObject*)stmt->ret.expr);
+void gc_add_value_to_grey(Ir *ir, Value v) {
+	if (isobject(v)) {
+		gc_add_to_grey(ir, (GCObject*)as_object(v));
+	}
+}
+
+void gc_mark(Ir *ir) {
+	for (size_t i = 0; i < ir->globals.size; i++) {
+		if (ir->globals.data[i]) {
+			gc_add_value_to_grey(ir, ir->globals.data[i]);
 		}
-	} break;
-	case STMT_CALL: {
-		gc_add_to_grey(ir, (GCObject*)stmt->call.expr);
-		if (stmt->call.args.size > 0) {
-			Value *arg;
-			for_array(stmt->call.args, arg) {
-				gc_add_to_grey(ir, (GCObject*)arg);
-			}
+	}
+	if (ir->stack) {
+		for (Value *v = ir->stack; v < ir->stack_top; v++) {
+			gc_add_value_to_grey(ir, *v);
 		}
-	} break;
-	case STMT_METHOD_CALL: {
-		gc_add_to_grey(ir, (GCObject*)stmt->method_call.expr);
-		if (stmt->method_call.args.size > 0) {
-			Value *arg;
-			for_array(stmt->method_call.args, arg) {
-				gc_add_to_grey(ir, (GCObject*)arg);
-			}
+	}
+}
+
+// Counts the heap blocks of tables and strings as well
+size_t gc_object_size(GCObject *obj) {
+	switch (obj->gc_kind) {
+	case GC_OBJECT: {
+		Object *o = (Object*)obj;
+		size_t size = sizeof(Object);
+		if (o->kind == VALUE_TABLE) {
+			if (o->table.map.entries) size += heap_size(o->table.map.entries);
+			if (o->table.array) size += heap_size(o->table.array);
+			if (o->table.fields) size += heap_size(o->table.fields);
 		}
-	} break;
-	case STMT_IF: {
-		gc_add_to_grey(ir, (GCObject*)stmt->_if.cond);
-		gc_add_to_grey(ir, (GCObject*)stmt->_if.if_block);
-		if (stmt->_if.else_block) {
-			gc_add_to_grey(ir, (GCObject*)stmt->_if.else_block);
+		else if (o->kind == VALUE_STRING) {
+			size += heap_size(o->string.str.str);
 		}
-	} break;
-	case STMT_WHILE: {
-		gc_add_to_grey(ir, (GCObject*)stmt->_while.cond);
-		gc_add_to_grey(ir, (GCObject*)stmt->_while.block);
-	} break;
-	case STMT_BLOCK: {
-		Stmt *st;
-		if (stmt->block.stmts.size > 0) {
-			for_array(stmt->block.stmts, st) {
-				gc_add_to_grey(ir, (GCObject*)st);
+		return size;
+	}
+	}
+	return 0;
+}
+
+// Moves a young object into the old generation, and only now counts it
+// towards the major collector's debt. While a major cycle is marking it is
+// marked grey so the cycle still traces it.
+void gc_promote(Ir *ir, GCObject *obj) {
+	assert(obj->gc_flags & GC_YOUNG);
+	obj->gc_flags &= ~GC_YOUNG;
+	ir->gc_debt += gc_object_size(obj);
+	if (ir->gc_marking) {
+		pool_mark(obj);
+		array_add(ir->grey_stack, obj);
+	}
+}
+
+// Old objects that may reference young ones are remembered, minor
+// collections trace the nursery from the roots and those alone
+void gc_remember(Ir *ir, GCObject *obj) {
+	if (obj->gc_flags & GC_REMEMBERED) return;
+	obj->gc_flags |= GC_REMEMBERED;
+	array_add(ir->remembered, obj);
+}
+
+// Old tables that store a young object are remembered. Rescanning a big
+// table every minor collection would cost more than the nursery saves, so a
+// young object stored into one is promoted right away instead and remembered
+// itself, as it may still reference young objects. A marked table that stores
+// an unmarked object greys it, or the major cycle could end without ever
+// scanning what it points to.
+#define GC_REMEMBER_MAX_SLOTS 1024
+void gc_write_barrier(Ir *ir, Object *t, Value v) {
+	if (!isobject(v)) return;
+	GCObject *obj = (GCObject*)as_object(v);
+	if (obj->gc_flags & GC_YOUNG) {
+		if (!(t->gc.gc_flags & GC_YOUNG)) {
+			size_t slots = t->table.array_cap + t->table.map.cap + table_fields_cap(t->table.shape);
+			if (slots <= GC_REMEMBER_MAX_SLOTS) {
+				gc_remember(ir, (GCObject*)t);
+			}
+			else {
+				gc_promote(ir, obj);
+				gc_remember(ir, obj);
 			}
 		}
-	} break;
-	case STMT_INCDEC: {
-		gc_add_to_grey(ir, (GCObject*)stmt->incdec.expr);
-	} break;
-	default: {
-		assert(!"How did we get here?");
-	} break;
+	}
+	else if (ir->gc_marking && !(t->gc.gc_flags & GC_YOUNG) && pool_marked(t)) {
+		gc_add_to_grey(ir, obj);
 	}
 }
 
-void gc_mark_value(Ir *ir, Value *v) {
-	if (v->gc.color == GC_BLACK) return;
-	gc_add_to_black(ir, (GCObject*)v);
+struct GCWorker {
+	Ir *ir;
+	Thread thread;
+	Array(GCObject*) stack;  // Only touched by the worker itself
+	Lock lock;
+	Array(GCObject*) shared; // What other workers may steal, guarded by lock
+	volatile long shared_count;
+	size_t scanned;
+};
 
-	switch (v->kind) {
-	case VALUE_BINOP: {
-		gc_add_to_grey(ir, (GCObject*)v->binary.lhs);
-		gc_add_to_grey(ir, (GCObject*)v->binary.rhs);
-	} break;
-	case VALUE_UNARY: {
-		gc_add_to_grey(ir, (GCObject*)v->unary.v);
-	} break;
-	case VALUE_INDEX: {
-		gc_add_to_grey(ir, (GCObject*)v->index.expr);
-		gc_add_to_grey(ir, (GCObject*)v->index.index);
-	} break;
-	case VALUE_CALL: {
-		gc_add_to_grey(ir, (GCObject*)v->call.expr);
-		if (v->call.args.size > 0) {
-			Value *arg;
-			for_array(v->call.args, arg) {
-				gc_add_to_grey(ir, (GCObject*)arg);
-			}
+// Set on the threads that take part in parallel marking
+THREAD_LOCAL GCWorker *gc_worker;
+
+void gc_worker_push(GCWorker *w, GCObject *obj);
+void gc_add_to_grey(Ir *ir, GCObject *obj) {
+	if (obj->gc_flags & (GC_YOUNG | GC_IMMORTAL)) {
+		if ((obj->gc_flags & GC_YOUNG) && ir->in_minor_gc) {
+			gc_promote(ir, obj);
+			array_add(ir->minor_stack, obj);
 		}
-	} break;
-	case VALUE_FIELD: {
-		gc_add_to_grey(ir, (GCObject*)v->field.expr);
-	} break;
-	case VALUE_METHOD_CALL: {
-		gc_add_to_grey(ir, (GCObject*)v->method_call.expr);
-		if (v->method_call.args.size > 0) {
-			Value *arg;
-			for_array(v->method_call.args, arg) {
-				gc_add_to_grey(ir, (GCObject*)arg);
-			}
+		return;
+	}
+	// Minor collections leave the old generation alone
+	if (ir->in_minor_gc || !ir->gc_marking) return;
+	if (gc_worker) {
+		if (pool_mark_shared(obj)) {
+			gc_worker_push(gc_worker, obj);
 		}
-	} break;
+		return;
+	}
+	if (pool_marked(obj)) return;
+	pool_mark(obj);
+	array_add(ir->grey_stack, obj);
+}
+
+// Adds everything v references to grey, or promotes it during a minor
+// collection. Code is not traced, every value it references is immortal.
+void gc_mark_object(Ir *ir, Object *v) {
+	switch (v->kind) {
 	case VALUE_FUNCTION: {
-		Function *f = &v->func;
+		Function *f = v->func;
 		switch (f->kind) {
 		case FUNCTION_NORMAL: {
-			Stmt *stmt;
-			if (f->normal.stmts.size > 0) {
-				for_array(f->normal.stmts, stmt) {
-					gc_add_to_grey(ir, (GCObject*)stmt);
-				}
+			if (f->normal.chunk) {
+				gc_mark_chunk(ir, f->normal.chunk);
 			}
 		} break;
 		case FUNCTION_NATIVE: {
@@ -688,181 +1111,538 @@ void gc_mark_value(Ir *ir, Value *v) {
 		}
 	} break;
 	case VALUE_TABLE: {
-		for (size_t i = 0; i < v->table.map.cap; i++) {
-			MapEntry *e = &v->table.map.entries[i];
-			if (e->hash) {
-				gc_add_to_grey(ir, (GCObject*)e->val);
+		if (v->table.shape) {
+			for (uint32_t i = 0; i < v->table.shape->count; i++) {
+				gc_add_value_to_grey(ir, v->table.fields[i]);
 			}
 		}
+		for (uint32_t i = 0; i < v->table.array_len; i++) {
+			gc_add_value_to_grey(ir, v->table.array[i]);
+		}
+		MapEntry *e;
+		for_map(v->table.map, e) {
+			gc_add_value_to_grey(ir, e->key);
+			gc_add_value_to_grey(ir, e->val);
+		}
 	} break;
-	case VALUE_INCDEC: {
-		gc_add_to_grey(ir, (GCObject*)v->incdec.expr);
+	}
+}
+
+// Frees what v owns but not v itself. May run on the sweeper thread, so it
+// must not touch the ir besides its heap.
+void gc_free_object_data(Heap *heap, Object *v) {
+	switch (v->kind) {
+	case VALUE_STRING: {
+		heap_free(heap, v->string.str.str);
+	} break;
+	case VALUE_TABLE: {
+		heap_free(heap, v->table.map.entries);
+		heap_free(heap, v->table.array);
+		heap_free(heap, v->table.fields);
+	} break;
+	case VALUE_FUNCTION: {
+		free(v->func->name.str);
+		switch (v->func->kind) {
+		case FUNCTION_NORMAL: {
+			if (v->func->normal.arg_names.size > 0) {
+				String *str;
+				for_array_ref(v->func->normal.arg_names, str) {
+					free(str->str);
+				}
+				array_free(v->func->normal.arg_names);
+			}
+			array_free(v->func->normal.stmts);
+			if (v->func->normal.chunk) {
+				free_chunk(v->func->normal.chunk);
+			}
+		} break;
+		}
+		free(v->func);
+	} break;
+	}
+}
+
+// Adds everything obj references to grey, returns how many bytes that scanned
+size_t gc_scan(Ir *ir, GCObject *obj) {
+	switch (obj->gc_kind) {
+	case GC_OBJECT: {
+		gc_mark_object(ir, (Object*) obj);
+	} break;
+	default: {
+		assert(!"Invalid gc_kind case");
+	}
+	}
+	return gc_object_size(obj);
+}
+
+void gc_free_data(Heap *heap, GCObject *obj) {
+	switch (obj->gc_kind) {
+	case GC_OBJECT: {
+		gc_free_object_data(heap, (Object*)obj);
 	} break;
+	default: {
+		assert(!"Invalid gc_kind");
+	}
+	}
+}
+
+// Frees a dead young object right away, used by minor collections
+void gc_free(Ir *ir, GCObject *obj) {
+	if (obj->gc_kind == GC_OBJECT && ((Object*)obj)->kind == VALUE_STRING) {
+		Object *v = (Object*)obj;
+		Value key = object_value(v);
+		map_remove(&ir->strings, map_find(&ir->strings, v->string.hash, 0, &key));
+	}
+	gc_free_data(&ir->heap, obj);
+	free_object(ir, (Object*)obj);
+}
+
+// Promotes every young object reachable from the roots or the remembered set
+// and frees the rest of the nursery. Survivors stay where they are, only
+// their flags change.
+void gc_minor(Ir *ir) {
+	if (!ir->do_gc) return;
+
+	ir->in_minor_gc = true;
+	gc_mark(ir);
+	for (size_t i = 0; i < ir->remembered.size; i++) {
+		GCObject *obj = ir->remembered.data[i];
+		obj->gc_flags &= ~GC_REMEMBERED;
+		gc_scan(ir, obj);
+	}
+	ir->remembered.size = 0;
+	while (ir->minor_stack.size > 0) {
+		GCObject *obj = ir->minor_stack.data[--ir->minor_stack.size];
+		gc_scan(ir, obj);
+	}
+	ir->in_minor_gc = false;
+
+	GCObject *obj;
+	for_array(ir->young, obj) {
+		if (obj->gc_flags & GC_YOUNG) {
+			ir->gc_minor_freed++;
+			ir->gc_minor_freed_bytes += gc_object_size(obj);
+			gc_free(ir, obj);
+		}
+	}
+	ir->young.size = 0;
+	ir->young_bytes = 0;
+	ir->minor_collections++;
+}
+
+bool gc_sweep_element(void *user, void *element) {
+	Ir *ir = user;
+	GCObject *obj = element;
+	if (obj->gc_flags & (GC_YOUNG | GC_IMMORTAL)) return false;
+	ir->gc_swept++;
+	ir->gc_swept_bytes += gc_object_size(obj);
+	gc_free_data(&ir->heap, obj);
+	return true;
+}
+
+// The intern map does not keep its strings alive, the dead ones have to be
+// removed before the sweeper frees them
+void gc_clear_dead_strings(Ir *ir) {
+	MapEntry *e;
+	for_map(ir->strings, e) {
+		GCObject *obj = (GCObject*)as_object(e->key);
+		if (!(obj->gc_flags & (GC_YOUNG | GC_IMMORTAL)) && !pool_marked(obj)) {
+			map_remove(&ir->strings, e);
+		}
+	}
+}
+
+// Besides the heap this only touches the sweep counters, the main thread
+// reads those once it has joined
+void gc_sweeper_run(void *arg) {
+	Ir *ir = arg;
+	long long start = time_stamp_time_now();
+	while (pool_sweep_next(&ir->object_pool, gc_sweep_element, ir));
+	ir->gc_sweep_time += time_stamp_time_now() - start;
+	atomic_add_long(&ir->gc_sweep_done, 1);
+}
+
+// Frees every unmarked old object. Only the current bucket of each pool is
+// swept here, the rest is swept bucket by bucket on the sweeper thread while
+// the program continues. Emptied buckets go back to the free list as soon as
+// they are swept, so allocation only has to wait once none are left.
+void gc_sweep_pools(Ir *ir) {
+	long long start = time_stamp_time_now();
+	gc_clear_dead_strings(ir);
+
+	pool_begin_sweep(&ir->object_pool);
+	pool_sweep_bucket(ir->object_pool.current_bucket, gc_sweep_element, ir);
+	ir->gc_sweep_time += time_stamp_time_now() - start;
+	heap_share(&ir->heap, true);
+	ir->gc_sweep_done = 0;
+	thread_start(&ir->gc_sweeper, gc_sweeper_run, ir);
+	ir->gc_sweeping = true;
+}
+
+// Free buckets past one in GC_TRIM_KEEP of those in use go back to the OS
+// once a sweep is done
+#define GC_TRIM_KEEP 4
+
+// The sweeper clears the mark bits as it goes, so it has to be done before
+// the next cycle starts marking. gc_step joins it as soon as it is done so
+// the heap stops taking its lock.
+void gc_finish_sweep(Ir *ir) {
+	if (!ir->gc_sweeping) return;
+	thread_join(ir->gc_sweeper);
+	heap_share(&ir->heap, false);
+	ir->gc_sweeping = false;
+
+	ir->gc_last_freed = ir->gc_swept;
+	ir->gc_last_freed_bytes = ir->gc_swept_bytes;
+	ir->gc_major_freed += ir->gc_swept;
+	ir->gc_major_freed_bytes += ir->gc_swept_bytes;
+	ir->gc_swept = 0;
+	ir->gc_swept_bytes = 0;
+
+	// Some slack is kept so the next cycle does not have to map it all again
+	pool_trim(&ir->object_pool, ir->object_pool.buckets / GC_TRIM_KEEP + 1);
+	heap_trim(&ir->heap, GC_TRIM_KEEP);
+}
+
+// Undefined globals are 0
+void gc_fix_value(Value *v) {
+	if (*v && isobject(*v) && (as_object(*v)->gc.gc_flags & GC_FORWARDED)) {
+		*v = object_value(as_object(*v)->forwarded);
+	}
+}
+
+void gc_fix_map(Map *map) {
+	MapEntry *e;
+	for_map(*map, e) {
+		gc_fix_value(&e->key);
+		gc_fix_value(&e->val);
+	}
+}
+
+void gc_fix_object(void *user, void *element) {
+	Object *o = element;
+	if (o->kind != VALUE_TABLE) return;
+	if (o->table.shape) {
+		for (uint32_t i = 0; i < o->table.shape->count; i++) {
+			gc_fix_value(&o->table.fields[i]);
+		}
 	}
+	for (uint32_t i = 0; i < o->table.array_len; i++) {
+		gc_fix_value(&o->table.array[i]);
+	}
+	gc_fix_map(&o->table.map);
 }
 
-void gc_mark_scope(Ir *ir, Scope *scope) {
-	if (scope->gc.color == GC_BLACK) return;
-	gc_add_to_black(ir, (GCObject*)scope);
+void gc_find_immortal(void *user, void *element) {
+	if (((GCObject*)element)->gc_flags & GC_IMMORTAL) {
+		*(bool*)user = true;
+	}
+}
 
-	for (size_t i = 0; i < scope->symbols.cap; i++) {
-		MapEntry *e = &scope->symbols.entries[i];
+void gc_move_object(void *user, void *element) {
+	Ir *ir = user;
+	Object *from = element;
+	Object *to = pool_alloc(&ir->object_pool);
+	memcpy(to, from, sizeof(Object));
+	from->gc.gc_flags |= GC_FORWARDED;
+	from->forwarded = to;
+	ir->objects_moved++;
+}
 
-		if (e->hash) {
-			Value *v = e->val;
-			gc_add_to_grey(ir, (GCObject*)v);
+// A survivor keeps its whole bucket from being freed, so a long running
+// program can end up holding mostly empty buckets. This moves the objects
+// out of buckets less than GC_COMPACT_PERCENT full so those can be trimmed.
+//
+// Objects are referenced by plain pointers, so moving one means finding every
+// reference to it. That is only possible in the outermost vm_execute, where
+// they are all on the stack, in globals, tables or the intern map. Shape
+// keys are immortal and never move.
+// Natives and the tree walker keep values in C locals, and literals are
+// referenced by compiled code, so buckets holding immortal objects stay.
+#define GC_COMPACT_PERCENT 25
+void gc_compact(Ir *ir) {
+	if (ir->use_tree_walker || ir->vm_depth != 1) return;
+
+	// Nothing may be young, grey or remembered while objects move
+	gc_minor(ir);
+	if (ir->young.size > 0) return;
+
+	Bucket *sparse = pool_take_sparse(&ir->object_pool, GC_COMPACT_PERCENT);
+	if (!sparse) return;
+
+	Bucket *moving = 0;
+	while (sparse) {
+		Bucket *bucket = sparse;
+		sparse = bucket->next;
+		bool immortal = false;
+		pool_visit_bucket(bucket, gc_find_immortal, &immortal);
+		if (immortal) {
+			pool_return_bucket(&ir->object_pool, bucket, false);
+		}
+		else {
+			bucket->next = moving;
+			moving = bucket;
+			pool_visit_bucket(bucket, gc_move_object, ir);
 		}
+	}
+	if (!moving) return;
 
+	for (size_t i = 0; i < ir->globals.size; i++) {
+		gc_fix_value(&ir->globals.data[i]);
+	}
+	for (Value *v = ir->stack; v < ir->stack_top; v++) {
+		gc_fix_value(v);
+	}
+	gc_fix_map(&ir->strings);
+	pool_visit(&ir->object_pool, gc_fix_object, ir);
 
+	while (moving) {
+		Bucket *bucket = moving;
+		moving = bucket->next;
+		pool_return_bucket(&ir->object_pool, bucket, true);
 	}
-	if (scope->parent) {
-		gc_add_to_grey(ir, (GCObject*)scope->parent);
+	pool_trim(&ir->object_pool, ir->object_pool.buckets / GC_TRIM_KEEP + 1);
+	ir->compactions++;
+}
+
+// A worker that has plenty left to scan moves the older half of its stack
+// where others can steal it
+#define GC_SHARE_SIZE 64
+void gc_worker_push(GCWorker *w, GCObject *obj) {
+	array_add(w->stack, obj);
+	if (w->stack.size >= 2 * GC_SHARE_SIZE && atomic_load_long(&w->shared_count) == 0) {
+		lock_acquire(&w->lock);
+		for (size_t i = 0; i < GC_SHARE_SIZE; i++) {
+			array_add(w->shared, w->stack.data[i]);
+		}
+		atomic_store_long(&w->shared_count, (long)w->shared.size);
+		lock_release(&w->lock);
+		w->stack.size -= GC_SHARE_SIZE;
+		memmove(w->stack.data, w->stack.data + GC_SHARE_SIZE, w->stack.size * sizeof(GCObject*));
 	}
 }
 
-void gc_free_value(Ir *ir, Value *v) {
-	switch (v->kind) {
-	case VALUE_STRING: {
-		//TODO: Replace with string_free
-		free(v->string.str.str);
-	} break;
-	case VALUE_TABLE: {
-		map_free(&v->table.map);
-	} break;
-	case VALUE_NAME: {
-		free(v->name.name.str);
-	} break;
-	case VALUE_FIELD: {
-		free(v->field.name.str);
-	} break;
-	case VALUE_METHOD_CALL: {
-		free(v->method_call.name.str);
-		array_free(v->method_call.args);
-	} break;
-	case VALUE_CALL: {
-		array_free(v->call.args);
-	} break;
-	case VALUE_TABLE_CONSTANT: {
-		array_free(v->table_constant.entries);
-	} break;
-	case VALUE_FUNCTION: {
-		free(v->func.name.str);
-		switch (v->func.kind) {
-		case FUNCTION_NORMAL: {
-			if (v->func.normal.arg_names.size > 0) {
-				String *str;
-				for_array_ref(v->func.normal.arg_names, str) {
-					free(str->str);
-				}
-				array_free(v->func.normal.arg_names);
-			}
-			array_free(v->func.normal.stmts);
-		} break;
+// Moves shared objects from one worker onto w's own stack, all of them when
+// they are w's own and half otherwise. Returns false if there were none.
+bool gc_worker_take(GCWorker *w, GCWorker *from) {
+	lock_acquire(&from->lock);
+	size_t count = from->shared.size;
+	if (from != w) count = (count + 1) / 2;
+	for (size_t i = 0; i < count; i++) {
+		array_add(w->stack, from->shared.data[--from->shared.size]);
+	}
+	atomic_store_long(&from->shared_count, (long)from->shared.size);
+	lock_release(&from->lock);
+	return count > 0;
+}
+
+bool gc_worker_find_work(GCWorker *w) {
+	Ir *ir = w->ir;
+	if (gc_worker_take(w, w)) return true;
+	size_t self = w - ir->gc_workers;
+	for (int i = 1; i < ir->gc_threads; i++) {
+		GCWorker *victim = &ir->gc_workers[(self + i) % ir->gc_threads];
+		if (atomic_load_long(&victim->shared_count) > 0 && gc_worker_take(w, victim)) {
+			return true;
 		}
-	} break;
 	}
-	free_value(ir, v);
+	return false;
 }
 
-void gc_free_stmt(Ir *ir, Stmt *stmt) {
-	switch(stmt->kind) {
-	case STMT_VAR: {
-		free(stmt->var.name.str);
-	} break;
-	case STMT_CALL: {
-		array_free(stmt->call.args);
-	} break;
-	case STMT_METHOD_CALL: {
-		array_free(stmt->method_call.args);
-		free(stmt->method_call.name.str);
-	} break;
-	case STMT_BLOCK: {
-		array_free(stmt->block.stmts);
-	} break;
+bool gc_any_shared_work(Ir *ir) {
+	for (int i = 0; i < ir->gc_threads; i++) {
+		if (atomic_load_long(&ir->gc_workers[i].shared_count) > 0) return true;
 	}
-
-	free_stmt(ir, stmt);
+	return false;
 }
 
-void gc_free_scope(Ir *ir, Scope *scope) {
-	if (scope->symbols.entries) {
-		map_free(&scope->symbols);
+void gc_worker_run(void *arg) {
+	GCWorker *w = arg;
+	Ir *ir = w->ir;
+	gc_worker = w;
+	for (;;) {
+		while (w->stack.size > 0) {
+			GCObject *obj = w->stack.data[--w->stack.size];
+			w->scanned += gc_scan(ir, obj);
+		}
+		if (gc_worker_find_work(w)) continue;
+
+		// Idle workers hold no work and cannot make more, so marking is done
+		// once every worker is idle at the same time
+		atomic_add_long(&ir->gc_idle_workers, 1);
+		while (atomic_load_long(&ir->gc_idle_workers) < ir->gc_threads && !gc_any_shared_work(ir)) {
+			thread_yield();
+		}
+		if (atomic_load_long(&ir->gc_idle_workers) == ir->gc_threads) break;
+		atomic_add_long(&ir->gc_idle_workers, -1);
 	}
-	free_scope(ir, scope);
+	gc_worker = 0;
 }
 
-void gc_do_greys(Ir *ir) {
-	if (!ir->do_gc) return;
-	// Just do them all for now
-
-	int work = 5;
-	GCObject **obj_list = &ir->grey_list;
-	while (*obj_list && work > 0) {
-		GCObject *obj = *obj_list;
-		*obj_list = obj->next;
-
-		// Mark obj black and all references grey
-		switch (obj->gc_kind) {
-		case GC_VALUE: {
-			gc_mark_value(ir, (Value*) obj);
-		} break;
-		case GC_STMT: {
-			gc_mark_stmt(ir, (Stmt*) obj);
-		} break;
-		case GC_SCOPE: {
-			gc_mark_scope(ir, (Scope*) obj);
-		} break;
-		default: {
-			assert(!"Invalid gc_kind case");
-		}
+// Scans the whole grey stack on gc_threads threads, the calling thread being
+// one of them. Returns how many bytes were scanned.
+size_t gc_mark_parallel(Ir *ir) {
+	if (!ir->gc_workers) {
+		ir->gc_workers = calloc(ir->gc_threads, sizeof(GCWorker));
+		for (int i = 0; i < ir->gc_threads; i++) {
+			ir->gc_workers[i].ir = ir;
+			lock_init(&ir->gc_workers[i].lock);
 		}
+	}
 
-		work--;
+	// The roots are dealt out evenly, stealing balances the rest
+	for (size_t i = 0; i < ir->grey_stack.size; i++) {
+		GCWorker *w = &ir->gc_workers[i % ir->gc_threads];
+		array_add(w->stack, ir->grey_stack.data[i]);
 	}
+	ir->grey_stack.size = 0;
+	ir->gc_idle_workers = 0;
 
-	if (ir->grey_list == 0) {
-		{
-			GCObject *obj = ir->white_list;
-			while (obj) {
-				GCObject *unreached = obj;
-				gc_remove_from_list(ir, obj);
-				obj = ir->white_list;
+	for (int i = 1; i < ir->gc_threads; i++) {
+		thread_start(&ir->gc_workers[i].thread, gc_worker_run, &ir->gc_workers[i]);
+	}
+	gc_worker_run(&ir->gc_workers[0]);
 
-				switch (unreached->gc_kind) {
-				case GC_VALUE: {
-					gc_free_value(ir, (Value*)unreached);
-				} break;
-				case GC_STMT: {
-					gc_free_stmt(ir, (Stmt*)unreached);
-				} break;
-				case GC_SCOPE: {
-					gc_free_scope(ir, (Scope*)unreached);
-				} break;
-				default: {
-					assert(!"Invalid gc_kind");
-				}
-				}
-			}
-		}
+	size_t total = ir->gc_workers[0].scanned;
+	ir->gc_workers[0].scanned = 0;
+	for (int i = 1; i < ir->gc_threads; i++) {
+		thread_join(ir->gc_workers[i].thread);
+		total += ir->gc_workers[i].scanned;
+		ir->gc_workers[i].scanned = 0;
+	}
+	return total;
+}
 
-		{
-			GCObject *obj = ir->black_list;
-			while (obj) {
-				GCObject *o = obj;
-				gc_remove_from_list(ir, o);
-				o->color = GC_WHITE;
-				o->next = ir->white_list;
-				if (o->next) {
-					o->next->prev = o;
-				}
-				o->prev = 0;
-				ir->white_list = o;
-				obj = ir->black_list;
-			}
-		}
+// Scans everything that is grey, returns how many bytes that scanned
+size_t gc_drain_greys(Ir *ir) {
+	if (ir->gc_threads > 1) {
+		return gc_mark_parallel(ir);
+	}
+	size_t total = 0;
+	while (ir->grey_stack.size > 0) {
+		GCObject *obj = ir->grey_stack.data[--ir->grey_stack.size];
+		total += gc_scan(ir, obj);
+	}
+	return total;
+}
+
+// Scans greys until at least budget bytes have been scanned, returns how many
+// bytes were actually scanned since a single table can be far over budget.
+// Parallel marking has to start its workers, which is only worth it for a
+// whole cycle at once, so then the budget is ignored.
+size_t gc_do_greys(Ir *ir, size_t budget) {
+	if (!ir->do_gc) return 0;
+	long long start = time_stamp_time_now();
+	if (!ir->gc_marking) {
+		gc_finish_sweep(ir);
+		if (ir->gc_compact) {
+			gc_compact(ir);
+		}
+		ir->gc_marking = true;
+		gc_mark(ir);
+	}
+
+	size_t total = 0;
+	if (ir->gc_threads > 1) {
+		total = gc_mark_parallel(ir);
+	}
+	while (ir->grey_stack.size > 0 && budget > 0) {
+		// Popping obj makes it black, scanning it greys all its references
+		GCObject *obj = ir->grey_stack.data[--ir->grey_stack.size];
+		size_t scanned = gc_scan(ir, obj);
+
+		budget -= min(budget, scanned);
+		total += scanned;
+	}
 
+	if (ir->grey_stack.size == 0) {
+		// Young objects may be all that references some old ones, so the
+		// nursery is emptied into the old generation before the sweep. This
+		// also leaves the remembered set empty, none of it can be freed.
+		// Writes to the stack and globals have no barrier, so the roots are
+		// marked again as well.
+		gc_minor(ir);
 		gc_mark(ir);
+		total += gc_drain_greys(ir);
+		size_t live = ir->gc_marked + total;
+		ir->gc_marked = 0;
+		total = 0;
+		ir->gc_mark_time += time_stamp_time_now() - start;
+
+		gc_sweep_pools(ir);
+
+		// The next cycle starts once the heap has grown by gc_pause percent
+		ir->gc_debt = -(int64_t)live * (ir->gc_pause - 100) / 100;
+		ir->gc_marking = false;
+		ir->major_collections++;
+		return 0;
+	}
+	ir->gc_marked += total;
+	ir->gc_mark_time += time_stamp_time_now() - start;
+	return total;
+}
+
+// Numbers and null do not allocate, so stepping a fixed amount per statement
+// makes the collector finish and restart its cycle constantly while a loop
+// filling a big table would barely step it. Instead scan gc_step_mul percent
+// of the bytes that have been allocated, counting what tables and strings
+// own. Scanning more than that leaves the debt negative so the program has to
+// allocate it back before the next step. A larger gc_step_mul means fewer but
+// longer pauses.
+//
+// Short lived objects never get that far, a minor collection runs whenever
+// GC_NURSERY_SIZE bytes have been allocated and only the survivors are added
+// to the debt.
+#define GC_STEP_SIZE (64 * sizeof(Object))
+#define GC_NURSERY_SIZE (256 * 1024)
+#define GC_DEFAULT_STEP_MUL 200
+#define GC_DEFAULT_PAUSE 200
+void gc_step(Ir *ir) {
+	if (ir->gc_sweeping && atomic_load_long(&ir->gc_sweep_done)) {
+		gc_finish_sweep(ir);
+	}
+	long long start = 0;
+	if (ir->young_bytes >= GC_NURSERY_SIZE) {
+		start = time_stamp_time_now();
+		gc_minor(ir);
+	}
+	if (ir->gc_debt >= (int64_t)GC_STEP_SIZE) {
+		if (!start) start = time_stamp_time_now();
+		uint64_t cycle = ir->major_collections;
+		size_t scanned = gc_do_greys(ir, ir->gc_debt * ir->gc_step_mul / 100);
+		if (ir->major_collections == cycle) {
+			// A finished cycle already reset the debt for its pause
+			ir->gc_debt -= scanned * 100 / ir->gc_step_mul;
+		}
+	}
+	if (start) {
+		ir->gc_max_pause = max(ir->gc_max_pause, time_stamp_time_now() - start);
+	}
+}
+
+// The -gcstats summary. A sweep still running on the sweeper thread is not
+// counted until gc_finish_sweep joins it.
+void gc_print_stats(Ir *ir) {
+	double freq = (double)time_stamp_freq();
+	uint64_t freed = ir->gc_minor_freed + ir->gc_major_freed;
+	printf("gc collections: %llu minor, %llu major, %llu compactions moving %llu objects\n",
+		(unsigned long long)ir->minor_collections, (unsigned long long)ir->major_collections,
+		(unsigned long long)ir->compactions, (unsigned long long)ir->objects_moved);
+	printf("gc objects: %llu allocated, %llu live, %llu freed by minor and %llu by major collections\n",
+		(unsigned long long)ir->allocated_values, (unsigned long long)(ir->allocated_values - freed),
+		(unsigned long long)ir->gc_minor_freed, (unsigned long long)ir->gc_major_freed);
+	printf("gc freed per major cycle: %.0f objects, %.0f bytes on average, %llu objects, %llu bytes last\n",
+		ir->major_collections ? (double)ir->gc_major_freed / ir->major_collections : 0.0,
+		ir->major_collections ? (double)ir->gc_major_freed_bytes / ir->major_collections : 0.0,
+		(unsigned long long)ir->gc_last_freed, (unsigned long long)ir->gc_last_freed_bytes);
+	printf("gc time: %.3f ms marking, %.3f ms sweeping, %.3f ms longest pause\n",
+		1000.0 * ir->gc_mark_time / freq, 1000.0 * ir->gc_sweep_time / freq, 1000.0 * ir->gc_max_pause / freq);
+	printf("gc live buckets: %zu objects, heap by class size", pool_bucket_count(&ir->object_pool));
+	for (size_t i = 0; i < HEAP_CLASS_COUNT; i++) {
+		printf(" %zu:%zu", heap_class_sizes[i], pool_bucket_count(&ir->heap.classes[i]));
 	}
+	printf("\n");
+	printf("gc heap: %zu bytes in use\n", heap_bytes(&ir->heap));
 }
 
 #if 0
@@ -1234,44 +2014,231 @@ void force_gc(Ir *ir) {
 }
 #endif
 
-Value* make_string_value(Ir *ir, String str) {
-	Value *v = alloc_value(ir);
-	v->kind = VALUE_STRING;
-	v->string.str = str;
-	return v;
+bool interned_key_eq(uint64_t stored, const void *key) {
+	return strings_match(as_string((Value)stored), *(const String*)key);
+}
+
+// Returns 0 if str has not been interned
+Value find_interned_string(Ir *ir, String str) {
+	MapEntry *e = map_find(&ir->strings, hash_bytes(str.str, str.len), interned_key_eq, &str);
+	if (!e) return 0;
+
+	// The string may be white and unreachable, it is about to be referenced
+	// again so it has to survive the current cycle
+	gc_add_to_grey(ir, (GCObject*)as_object(e->key));
+	return e->key;
 }
 
-Value* make_number_value(Ir *ir, double n) {
-	Value *v = alloc_value(ir);
-	v->kind = VALUE_NUMBER;
-	v->number.value = n;
+// Keeps obj alive for good. Used for literals, which code may reference
+// until the program exits, so the collector does not have to scan or sweep
+// them every cycle.
+void make_immortal(Ir *ir, GCObject *obj) {
+	if (obj->gc_flags & GC_IMMORTAL) return;
+	obj->gc_flags = (obj->gc_flags & ~GC_YOUNG) | GC_IMMORTAL;
+	ir->immortal_count++;
+}
+
+// Literal strings are interned and made immortal, numbers and null are
+// returned as is
+Value make_literal(Ir *ir, Value v) {
+	if (isobject(v)) {
+		make_immortal(ir, (GCObject*)as_object(v));
+	}
 	return v;
 }
 
-Value* make_native_function(Ir *ir, String name, Value* (*func)(Ir *ir, ValueArray args)) {
-	Value *v = alloc_value(ir);
-	v->kind = VALUE_FUNCTION;
-	v->func.kind = FUNCTION_NATIVE;
-	v->func.native.function = func;
-	v->func.name = make_string_copy(name);
+Value make_interned_string(Ir *ir, String str, uint64_t hash) {
+	Object *v = alloc_object(ir, VALUE_STRING);
+	v->string.str = str;
+	v->string.hash = hash;
+	ir->young_bytes += heap_size(str.str);
+	map_insert(&ir->strings, hash, object_value(v), object_value(v));
+	return object_value(v);
+}
+
+// Copies str only if no equal string exists yet
+Value intern_string(Ir *ir, String str) {
+	Value v = find_interned_string(ir, str);
+	if (v) return v;
+	return make_interned_string(ir, heap_string_copy(&ir->heap, str), hash_bytes(str.str, str.len));
+}
+
+// Takes ownership of str, which is copied into the heap if it is new
+Value make_string_value(Ir *ir, String str) {
+	Value v = intern_string(ir, str);
+	free(str.str);
 	return v;
 }
 
-Stmt* alloc_stmt(Ir *ir, SourceLoc loc) {
-	Stmt *stmt = pool_alloc(&ir->stmt_pool);
+Value make_table_value(Ir *ir) {
+	Object *v = alloc_object(ir, VALUE_TABLE);
+	v->table.shape = ir->root_shape;
+	return object_value(v);
+}
 
-	stmt->gc.gc_kind = GC_STMT;
-	stmt->gc.color = GC_GREY;
-	stmt->gc.next = ir->grey_list;
-	stmt->gc.prev = 0;
-	ir->grey_list = (GCObject*)stmt;
+void table_array_reserve(Ir *ir, Object *t, uint32_t count) {
+	if (count <= t->table.array_cap) return;
+	t->table.array = table_realloc(ir, t, t->table.array, count * sizeof(Value));
+	t->table.array_cap = count;
+}
 
-	stmt->loc = loc;
-	return stmt;
+// The key of a name = v entry
+String table_entry_name(Ir *ir, TableEntry *e) {
+	assert(e->kind == ENTRY_KEY);
+	if (e->key->kind == NODE_NAME) {
+		return e->key->name.name;
+	}
+	else if (e->key->kind != NODE_STRING) {
+		ir_error(ir, "Expected left hand side of assignment to be a name or string!");
+	}
+	return e->key->string.string;
+}
+
+void free_table_template(TableTemplate *template) {
+	array_free(template->slots);
+	free(template);
+}
+
+// Returns 0 if the constructor has to be built entry by entry
+TableTemplate* make_table_template(Ir *ir, Node *n) {
+	assert(n->kind == NODE_TABLE);
+	if (n->table.entries.size > TEMPLATE_MAX_ENTRIES) return 0;
+
+	TableTemplate *template = calloc(1, sizeof(TableTemplate));
+	template->shape = ir->root_shape;
+	TableEntry *e;
+	for_array_ref(n->table.entries, e) {
+		if (e->kind == ENTRY_NORMAL) {
+			array_add(template->slots, TEMPLATE_ARRAY);
+			template->array_count++;
+		}
+		else if (e->kind == ENTRY_KEY) {
+			Value key = make_literal(ir, intern_string(ir, table_entry_name(ir, e)));
+			if (shape_find(template->shape, key) >= 0 || template->shape->count == SHAPE_MAX_FIELDS) {
+				free_table_template(template);
+				return 0;
+			}
+			array_add(template->slots, template->shape->count);
+			template->shape = shape_add(ir, template->shape, key);
+		}
+		else {
+			free_table_template(template);
+			return 0;
+		}
+	}
+	return template;
+}
+
+// values holds one value per entry of the constructor, in order
+Value make_table_from_template(Ir *ir, TableTemplate *template, Value *values) {
+	Value table = make_table_value(ir);
+	Object *t = as_object(table);
+	size_t field_cap = table_fields_cap(template->shape);
+	if (field_cap) {
+		t->table.fields = table_realloc(ir, t, 0, field_cap * sizeof(Value));
+	}
+	t->table.shape = template->shape;
+	table_array_reserve(ir, t, template->array_count);
+
+	// Positional entries go straight into the array until the first null,
+	// which table_put drops, the ones after it are put like table_put would
+	bool null_field = false;
+	uint32_t index = 0;
+	for (size_t i = 0; i < template->slots.size; i++) {
+		uint32_t slot = template->slots.data[i];
+		if (slot == TEMPLATE_ARRAY) {
+			if (index == t->table.array_len && !isnull(values[i])) {
+				t->table.array[t->table.array_len++] = values[i];
+			}
+			else {
+				table_put(ir, table, make_number_value(ir, (double)index), values[i]);
+			}
+			index++;
+		}
+		else {
+			t->table.fields[slot] = values[i];
+			null_field |= isnull(values[i]);
+		}
+	}
+
+	if (null_field) {
+		// Assigning null removes a key, which takes the table out of the shape
+		table_to_dictionary(ir, t);
+		MapEntry *e;
+		for_map(t->table.map, e) {
+			if (isnull(e->val)) map_remove(&t->table.map, e);
+		}
+	}
+	return table;
+}
+
+Value make_native_function(Ir *ir, String name, Value (*func)(Ir *ir, ValueArray args)) {
+	Object *v = alloc_object(ir, VALUE_FUNCTION);
+	v->func = calloc(1, sizeof(Function));
+	v->func->kind = FUNCTION_NATIVE;
+	v->func->native.function = func;
+	v->func->name = make_string_copy(name);
+	return object_value(v);
+}
+
+Value make_function_value(Ir *ir, String name, SourceLoc loc, StringArray arg_names, Node *block) {
+	Object *v = alloc_object(ir, VALUE_FUNCTION);
+	Function *f = calloc(1, sizeof(Function));
+	gc_add_owned(ir, v, sizeof(Function));
+	v->func = f;
+	f->kind = FUNCTION_NORMAL;
+	f->name = make_string_copy(name);
+	f->loc = loc;
+	f->normal.arg_names = arg_names;
+	f->normal.block = block;
+	if (ir->use_tree_walker) {
+		Resolver *outer = ir->resolver;
+		Resolver resolver = { 0 };
+		ir->resolver = &resolver;
+		if (arg_names.size > 0) {
+			String *arg;
+			for_array_ref(arg_names, arg) {
+				declare_local(ir, &resolver, *arg);
+			}
+		}
+		f->normal.stmts = convert_nodes_to_stmts(ir, block->block.stmts);
+		f->normal.frame_size = resolver.frame_size;
+		array_free(resolver.locals);
+		ir->resolver = outer;
+	}
+	return object_value(v);
+}
+
+Expr* alloc_expr(Ir *ir, ExprKind kind) {
+	Expr *expr = arena_alloc(&ir->code, sizeof(Expr));
+	expr->kind = kind;
+	return expr;
+}
+
+Expr* make_constant_expr(Ir *ir, Value value) {
+	Expr *expr = alloc_expr(ir, EXPR_CONSTANT);
+	expr->constant.value = value;
+	return expr;
+}
+
+// Every use of the same literal shares one expression
+Expr* make_literal_expr(Ir *ir, Value value) {
+	value = make_literal(ir, value);
+	uint64_t hash = hash_uint64(value);
+	MapEntry *e = map_find(&ir->literals, hash, 0, &value);
+	if (e) return (Expr*)e->val;
+
+	Expr *expr = make_constant_expr(ir, value);
+	map_insert(&ir->literals, hash, value, (uint64_t)expr);
+	return expr;
 }
 
-void free_stmt(Ir *ir, Stmt *stmt) {
-	pool_release(&ir->stmt_pool, stmt);
+// Code lives as long as the program, so it is not part of the gc heap and
+// is never traced. Every value it references is made immortal instead.
+Stmt* alloc_stmt(Ir *ir, SourceLoc loc) {
+	Stmt *stmt = arena_alloc(&ir->code, sizeof(Stmt));
+	stmt->loc = loc;
+	return stmt;
 }
 
 Stmt* convert_node_to_stmt(Ir *ir, Node *n) {
@@ -1284,8 +2251,10 @@ Stmt* convert_node_to_stmt(Ir *ir, Node *n) {
 			stmt->var.expr = expr_to_value(ir, n->var.expr);
 		}
 		else {
-			stmt->var.expr = null_value;
+			stmt->var.expr = make_literal_expr(ir, null_value);
 		}
+		ir->loc = n->loc;
+		stmt->var.slot = declare_local(ir, ir->resolver, n->var.name);
 		return stmt;
 	} break;
 	case NODE_RETURN: {
@@ -1309,7 +2278,9 @@ Stmt* convert_node_to_stmt(Ir *ir, Node *n) {
 		Stmt *stmt = alloc_stmt(ir, n->loc);
 		stmt->kind = STMT_BLOCK;
 		if (n->block.stmts.size > 0) {
+			begin_scope(ir->resolver);
 			stmt->block.stmts = convert_nodes_to_stmts(ir, n->block.stmts);
+			end_scope(ir->resolver);
 		}
 		return stmt;
 	} break;
@@ -1336,7 +2307,8 @@ Stmt* convert_node_to_stmt(Ir *ir, Node *n) {
 		Stmt *stmt = alloc_stmt(ir, n->loc);
 		stmt->kind = STMT_METHOD_CALL;
 		stmt->method_call.expr = expr_to_value(ir, n->method_call.expr);
-		stmt->method_call.name = make_string_copy(n->method_call.name);
+		stmt->method_call.name = make_literal(ir, intern_string(ir, n->method_call.name));
+		stmt->method_call.cache = calloc(1, sizeof(InlineCache));
 		if (n->method_call.args.size > 0) {
 			Node *arg;
 			for_array(n->method_call.args, arg) {
@@ -1367,8 +2339,7 @@ Stmt* convert_node_to_stmt(Ir *ir, Node *n) {
 		stmt->kind = STMT_ASSIGN;
 		stmt->assign.left = expr_to_value(ir, n->incdec.expr);
 
-		Value *binop = alloc_value(ir);
-		binop->kind = VALUE_BINOP;
+		Expr *binop = alloc_expr(ir, EXPR_BINOP);
 		if (n->incdec.op == TOKEN_INCREMENT) {
 			binop->binary.op = TOKEN_PLUS;
 		} else if (n->incdec.op == TOKEN_DECREMENT) {
@@ -1378,7 +2349,7 @@ Stmt* convert_node_to_stmt(Ir *ir, Node *n) {
 			assert(!"Invalid incdec op");
 		}
 		binop->binary.lhs = expr_to_value(ir, n->incdec.expr);
-		binop->binary.rhs = make_number_value(ir, 1);
+		binop->binary.rhs = make_literal_expr(ir, make_number_value(ir, 1));
 		stmt->assign.right = binop;
 
 		return stmt;
@@ -1414,7 +2385,7 @@ void ir_use_library(Ir *ir, String name) {
 }
 
 void ir_import_file(Ir *ir, String path, String as);
-void convert_top_levels_to_ir(Ir *ir, Scope *scope, NodeArray stmts) {
+void convert_top_levels_to_ir(Ir *ir, NodeArray stmts) {
 	Node *n;
 	for_array(stmts, n) {
 		ir->loc = n->loc;
@@ -1426,20 +2397,20 @@ void convert_top_levels_to_ir(Ir *ir, Scope *scope, NodeArray stmts) {
 			ir_use_library(ir, n->use.name);
 		} break;
 		case NODE_VAR: {
-			Value *v = eval_value(ir, ir->file_scope, expr_to_value(ir, n->var.expr));
-			scope_add(ir, ir->file_scope, n->var.name, v);
+			Value v = null_value;
+			if (n->var.expr) {
+				if (ir->use_tree_walker) {
+					v = eval_value(ir, 0, expr_to_value(ir, n->var.expr));
+				}
+				else {
+					v = vm_eval_top_level(ir, n->var.expr);
+				}
+			}
+			global_add(ir, n->var.name, v);
 		} break;
 		case NODE_FUNC: {
-			Value *v = alloc_value(ir);
-			v->kind = VALUE_FUNCTION;
-			Function *f = &v->func;
-			f->kind = FUNCTION_NORMAL;
-			f->name = make_string_copy(n->func.name);
-			f->loc = n->loc;
-			f->normal.arg_names = n->func.args;
-			f->normal.stmts = convert_nodes_to_stmts(ir, n->func.block->block.stmts);
-
-			scope_add(ir, ir->file_scope, n->func.name, v);
+			Value v = make_function_value(ir, n->func.name, n->loc, n->func.args, n->func.block);
+			global_add(ir, n->func.name, v);
 		} break;
 		default: {
 			assert(!"Unhandled top level to ir");
@@ -1454,64 +2425,80 @@ void ir_import_file(Ir *ir, String path, String as) {
 	memset(&p, 0, sizeof(Parser));
 	init_parser(&p, path);
 	NodeArray stmts = parse(&p);
+	optimize(stmts);
+	if (ir->dump_ir) {
+		printf("// %.*s\n", (int)path.len, path.str);
+		dump_nodes(stmts);
+	}
 
 	assert(as.str == 0 && as.len == 0); //TODO: Implement namespace
 	//TODO: Handle recursive imports
 	//TODO: Give every file its own scope, that way, another file cant access our variables etc.
-	convert_top_levels_to_ir(ir, ir->file_scope, stmts);
+	convert_top_levels_to_ir(ir, stmts);
 }
 
-void gc_mark(Ir *ir);
 void init_ir(Ir *ir, NodeArray stmts) {
-	pool_init(&ir->value_pool, sizeof(Value), 4096);
-	pool_init(&ir->scope_pool, sizeof(Scope), 128);
-	pool_init(&ir->stmt_pool, sizeof(Stmt), 128);
+	pool_init(&ir->object_pool, sizeof(Object), 4096);
+	arena_init(&ir->code, 64 * 1024);
+	heap_init(&ir->heap);
 	
 	ir->do_gc = false;
-	ir->max_allocated_values = 1024;
+	if (!ir->gc_step_mul) ir->gc_step_mul = GC_DEFAULT_STEP_MUL;
+	if (!ir->gc_pause) ir->gc_pause = GC_DEFAULT_PAUSE;
+	if (!ir->gc_threads) ir->gc_threads = 1;
 	ir->allocated_values = 0;
 	
-	ir->white_list = 0;
-	ir->grey_list = 0;
-	ir->black_list = 0;
 
-	ir->global_scope = make_scope(ir, 0);
-	ir->file_scope = make_scope(ir, ir->global_scope);
-	convert_top_levels_to_ir(ir, ir->file_scope, stmts);
+	ir->root_shape = make_shape(ir, 0, 0);
+
+	init_vm(ir);
+
+	convert_top_levels_to_ir(ir, stmts);
 
 	add_globals(ir);
 
-	// printf("sizeof(Value): %d\n", (int)sizeof(Value));
+	// printf("sizeof(Object): %d\n", (int)sizeof(Object));
 
 	ir->do_gc = true;
+}
 
-	gc_mark(ir);
+bool is_assignable_expr(Expr *expr) {
+	return expr->kind == EXPR_NAME || expr->kind == EXPR_FIELD || expr->kind == EXPR_INDEX;
 }
 
-void do_assign(Ir *ir, Scope *scope, Value *lhs, Value *rhs) {
-	if (lhs->kind != VALUE_NAME && lhs->kind != VALUE_FIELD && lhs->kind != VALUE_INDEX) {
+void do_assign(Ir *ir, Value *frame, Expr *lhs, Expr *rhs) {
+	if (!is_assignable_expr(lhs)) {
 		// Error not supported assignemtn or something else?
-		lhs = eval_value(ir, scope, lhs);
-	}
-	if (lhs->kind != VALUE_NAME && lhs->kind != VALUE_FIELD && lhs->kind != VALUE_INDEX) {
+		eval_value(ir, frame, lhs);
 		ir_error(ir, "Cannot assign to left hand");
 	}
 
 	switch (lhs->kind) {
-	case VALUE_NAME: {
-		rhs = eval_value(ir, scope, rhs);
-		scope_set(ir, scope, lhs->name.name, rhs);
+	case EXPR_NAME: {
+		Value v = eval_value(ir, frame, rhs);
+		if (lhs->name.local) {
+			check_assign(ir, frame[lhs->name.slot]);
+			frame[lhs->name.slot] = v;
+		}
+		else {
+			global_set(ir, lhs->name.slot, v);
+		}
 	} break;
-	case VALUE_FIELD: {
-		Value *expr = eval_value(ir, scope, lhs->field.expr);
-		rhs = eval_value(ir, scope, rhs);
-		table_put_name(ir, expr, lhs->field.name, rhs);
+	case EXPR_FIELD: {
+		Value expr = eval_value(ir, frame, lhs->field.expr);
+		push_temp(ir, expr);
+		Value v = eval_value(ir, frame, rhs);
+		ir->stack_top--;
+		table_put_cached(ir, expr, lhs->field.name, v, lhs->field.cache);
 	} break;
-	case VALUE_INDEX: {
-		Value *expr = eval_value(ir, scope, lhs->index.expr);
-		Value *index = eval_value(ir, scope, lhs->index.index);
-		rhs = eval_value(ir, scope, rhs);
-		table_put(ir, expr, index, rhs);
+	case EXPR_INDEX: {
+		Value expr = eval_value(ir, frame, lhs->index.expr);
+		push_temp(ir, expr);
+		Value index = eval_value(ir, frame, lhs->index.index);
+		push_temp(ir, index);
+		Value v = eval_value(ir, frame, rhs);
+		ir->stack_top -= 2;
+		table_put(ir, expr, index, v);
 	} break;
 	default: {
 		ir_error(ir, "Cannot assign to left hand");
@@ -1519,68 +2506,132 @@ void do_assign(Ir *ir, Scope *scope, Value *lhs, Value *rhs) {
 	}
 }
 
+// Pushes the callee and arguments of a call or method call expression, see
+// push_callee. Returns where the callee went.
+Value* eval_call_args(Ir *ir, Value *frame, Expr *v, size_t *argc) {
+	if (v->kind == EXPR_CALL) {
+		Value func = eval_value(ir, frame, v->call.expr);
+		if (!isfunction(func)) {
+			ir_error(ir, "Tried to call non-function value");
+		}
+		Value *base = push_callee(ir, func, v->call.args.size);
+		if (v->call.args.size > 0) {
+			Expr *arg;
+			for_array(v->call.args, arg) {
+				Value v = eval_value(ir, frame, arg);
+				*ir->stack_top++ = v;
+			}
+		}
+		*argc = v->call.args.size;
+		return base;
+	}
+
+	assert(v->kind == EXPR_METHOD_CALL);
+	Value table = eval_value(ir, frame, v->method_call.expr);
+	if (!istable(table)) {
+		ir_error(ir, "':' operator only works with tables as lvalues");
+	}
+
+	Value func = table_get_cached(ir, table, v->method_call.name, v->method_call.cache); // Should return null for non existing values
+	if (!func) {
+		ir_error(ir, "Table does not contain any value called: %.*s", (int)as_string(v->method_call.name).len, as_string(v->method_call.name).str);
+	}
+	if (!isfunction(func)) {
+		ir_error(ir, "Right hand side of ':' operator is not a function");
+	}
+
+	Value *base = push_callee(ir, func, v->method_call.args.size + 1);
+	*ir->stack_top++ = table;
+	if (v->method_call.args.size > 0) {
+		Expr *arg;
+		for_array(v->method_call.args, arg) {
+			Value v = eval_value(ir, frame, arg);
+			*ir->stack_top++ = v;
+		}
+	}
+	*argc = v->method_call.args.size + 1;
+	return base;
+}
+
 // True if we had a return,break,continue, etc
-bool eval_stmt(Ir *ir, Scope *scope, Stmt *stmt, Value **return_value) {
+bool eval_stmt(Ir *ir, Value *frame, Stmt *stmt, Value *return_value) {
 	ir->loc = stmt->loc;
 	//do_gc(ir);
-	gc_do_greys(ir);
+	gc_step(ir);
 	switch (stmt->kind) {
 	case STMT_VAR: {
-		Value *v = eval_value(ir, scope, stmt->var.expr);
-		scope_add(ir, scope, stmt->var.name, v);
+		frame[stmt->var.slot] = eval_value(ir, frame, stmt->var.expr);
 	} break;
 	case STMT_RETURN: {
-		if (stmt->ret.expr) {
-			*return_value = eval_value(ir, scope, stmt->ret.expr);
+		Expr *expr = stmt->ret.expr;
+		if (expr && (expr->kind == EXPR_CALL || expr->kind == EXPR_METHOD_CALL)) {
+			// Script functions are left for eval_function to run in this frame
+			size_t argc;
+			Value *base = eval_call_args(ir, frame, expr, &argc);
+			if (as_function(*base)->kind == FUNCTION_NORMAL) {
+				ir->tail_call = base;
+				ir->tail_argc = argc;
+				ir->tail_is_method_call = expr->kind == EXPR_METHOD_CALL;
+				return true;
+			}
+			ValueArray args = { base + 1, argc, argc };
+			*return_value = call_function(ir, *base, args, expr->kind == EXPR_METHOD_CALL);
+			ir->stack_top = base;
+		}
+		else if (expr) {
+			*return_value = eval_value(ir, frame, expr);
 		}
 		return true;
 	} break;
 	case STMT_ASSIGN: {
-		do_assign(ir, scope, stmt->assign.left, stmt->assign.right);
+		do_assign(ir, frame, stmt->assign.left, stmt->assign.right);
 	} break;
 	case STMT_CALL: {
-		Value *func = eval_value(ir, scope, stmt->call.expr);
+		Value func = eval_value(ir, frame, stmt->call.expr);
 		if (!isfunction(func)) {
 			ir_error(ir, "Tried to call a non-function value!");
 		}
-		ValueArray args = { 0 };
+		Value *base = push_callee(ir, func, stmt->call.args.size);
 		if (stmt->call.args.size > 0) {
-			Value *arg;
+			Expr *arg;
 			for_array(stmt->call.args, arg) {
-				Value *v = eval_value(ir, scope, arg);
-				array_add(args, v);
+				Value v = eval_value(ir, frame, arg);
+				*ir->stack_top++ = v;
 			}
 		}
+		ValueArray args = { base + 1, stmt->call.args.size, stmt->call.args.size };
 		call_function(ir, func, args, false);
-		array_free(args);
+		ir->stack_top = base;
 	} break;
 	case STMT_METHOD_CALL: {
-		Value *table = eval_value(ir, scope, stmt->method_call.expr);
+		Value table = eval_value(ir, frame, stmt->method_call.expr);
 		if (!istable(table)) {
 			ir_error(ir, "':' operator only works with tables as lvalues");
 		}
 
 		//TODO: Give error if value from table is null
-		Value *func = table_get_name(ir, table, stmt->method_call.name);
+		Value func = table_get_cached(ir, table, stmt->method_call.name, stmt->method_call.cache);
 		if (!func) {
-			ir_error(ir, "Table does not contain any value called: %.*s", (int)stmt->method_call.name.len, stmt->method_call.name.str);
+			ir_error(ir, "Table does not contain any value called: %.*s", (int)as_string(stmt->method_call.name).len, as_string(stmt->method_call.name).str);
 		}
 		if (!isfunction(func)) {
 			ir_error(ir, "Right hand side of ':' operator is not a function");
 		}
 
-		ValueArray args = { 0 };
-		array_add(args, table);
+		size_t argc = stmt->method_call.args.size + 1;
+		Value *base = push_callee(ir, func, argc);
+		*ir->stack_top++ = table;
 		if (stmt->method_call.args.size > 0) {
-			Value *arg;
+			Expr *arg;
 			for_array(stmt->method_call.args, arg) {
-				Value *v = eval_value(ir, scope, arg);
-				array_add(args, v);
+				Value v = eval_value(ir, frame, arg);
+				*ir->stack_top++ = v;
 			}
 		}
 
+		ValueArray args = { base + 1, argc, argc };
 		call_function(ir, func, args, true);
-		array_free(args);
+		ir->stack_top = base;
 	} break;
 	case STMT_BREAK: {
 		IncompletePath();
@@ -1589,32 +2640,32 @@ bool eval_stmt(Ir *ir, Scope *scope, Stmt *stmt, Value **return_value) {
 		IncompletePath();
 	} break;
 	case STMT_IF: {
-		Value *cond = eval_value(ir, scope, stmt->_if.cond);
+		Value cond = eval_value(ir, frame, stmt->_if.cond);
 		if (!isnumber(cond) && !isnull(cond)) {
 			ir_error(ir, "Condition does not evaluate to number or null.");
 		}
-		if (cond->kind == VALUE_NULL || cond->number.value == 0.0) {
+		if (isnull(cond) || as_number(cond) == 0.0) {
 			// else
 			if (stmt->_if.else_block) {
-				return eval_stmt(ir, scope, stmt->_if.else_block, return_value);
+				return eval_stmt(ir, frame, stmt->_if.else_block, return_value);
 			}
 		}
 		else {
 			// true
-			return eval_stmt(ir, scope, stmt->_if.if_block, return_value);
+			return eval_stmt(ir, frame, stmt->_if.if_block, return_value);
 		}
 	} break;
 	case STMT_WHILE: {
-		Value *cond = eval_value(ir, scope, stmt->_while.cond);
+		Value cond = eval_value(ir, frame, stmt->_while.cond);
 		if (!isnumber(cond) && !isnull(cond)) {
 			ir_error(ir, "Condition does not evaluate to number or null.");
 		}
 
-		while (cond->kind != VALUE_NULL && cond->number.value != 0) {
-			bool returned = eval_stmt(ir, scope, stmt->_while.block, return_value);
+		while (!isnull(cond) && as_number(cond) != 0) {
+			bool returned = eval_stmt(ir, frame, stmt->_while.block, return_value);
 			if (returned) return returned;
 			
-			cond = eval_value(ir, scope, stmt->_while.cond);
+			cond = eval_value(ir, frame, stmt->_while.cond);
 			if (!isnumber(cond) && !isnull(cond)) {
 				ir_error(ir, "Condition does not evaluate to number or null.");
 			}
@@ -1622,16 +2673,11 @@ bool eval_stmt(Ir *ir, Scope *scope, Stmt *stmt, Value **return_value) {
 	} break;
 	case STMT_BLOCK: {
 		if (stmt->block.stmts.size > 0) {
-			Scope *block_scope = push_scope(ir, scope);
 			Stmt *block_stmt;
 			for_array(stmt->block.stmts, block_stmt) {
-				bool returned = eval_stmt(ir, block_scope, block_stmt, return_value);
-				if (returned) {
-					pop_scope(ir);
-					return returned;
-				}
+				bool returned = eval_stmt(ir, frame, block_stmt, return_value);
+				if (returned) return returned;
 			}
-			pop_scope(ir);
 		}
 	} break;
 	default: {
@@ -1643,59 +2689,89 @@ bool eval_stmt(Ir *ir, Scope *scope, Stmt *stmt, Value **return_value) {
 	return false;
 }
 
-Value* eval_function(Ir *ir, Function func, ValueArray args, bool is_method_call) {
+Value eval_function(Ir *ir, Value func_value, ValueArray args, bool is_method_call) {
 	// Check that we recieved the right amount of args
 	// Register args with appropiate names
 	// Eval all stmts
-	Value *return_value = null_value;
+	Function *func = as_function(func_value);
+	Value return_value = null_value;
+
+	// Arguments and locals live on the value stack, popped by resetting stack_top.
+	// Arguments pushed by the caller after the callee are already where the
+	// frame starts, otherwise they are copied to the top. Either way frame[-1]
+	// holds the callee, tail calls replace it to keep the new callee alive.
+	Value *top = ir->stack_top;
+	Value *frame = args.data;
+	if (!(args.data > ir->stack && args.data + args.size == top && args.data[-1] == func_value)) {
+		frame = top + 1;
+		if (frame + args.size > ir->stack + VM_STACK_SIZE) {
+			ir_error(ir, "Stack overflow!");
+		}
+		frame[-1] = func_value;
+		for (size_t i = 0; i < args.size; i++) {
+			frame[i] = args.data[i];
+		}
+	}
+
+	for (;;) {
+		if (func->normal.arg_names.size != args.size) {
+			if (is_method_call) {
+				ir_error(ir, "Argument count mismatch! Wanted %d got %d. This function was called as a method which means the left hand side of ':' is passed as the first argument.", (int)func->normal.arg_names.size, (int)args.size);
+			}
+			else {
+				ir_error(ir, "Argument count mismatch! Wanted %d got %d.", (int)func->normal.arg_names.size, (int)args.size);
+			}
+		}
 
-	if (func.normal.arg_names.size != args.size) {
-		if (is_method_call) {
-			ir_error(ir, "Argument count mismatch! Wanted %d got %d. This function was called as a method which means the left hand side of ':' is passed as the first argument.", (int)func.normal.arg_names.size, (int)args.size);
+		if (frame + func->normal.frame_size > ir->stack + VM_STACK_SIZE) {
+			ir_error(ir, "Stack overflow!");
 		}
-		else {
-			ir_error(ir, "Argument count mismatch! Wanted %d got %d.", (int)func.normal.arg_names.size, (int)args.size);
+		for (size_t i = args.size; i < func->normal.frame_size; i++) {
+			frame[i] = null_value;
 		}
-	}
+		ir->stack_top = frame + func->normal.frame_size;
 
-	if (func.normal.stmts.size > 0) {
-		Scope *scope = push_scope(ir, ir->file_scope);
-		for (int i = 0; i < args.size; i++) {
-			scope_add(ir, scope, func.normal.arg_names.data[i], args.data[i]);
-		}
-		Stmt *stmt;
-		for_array(func.normal.stmts, stmt) {
-			bool returned = eval_stmt(ir, scope, stmt, &return_value);
-			if (returned) {
-				pop_scope(ir);
-				return return_value;
+		if (func->normal.stmts.size > 0) {
+			Stmt *stmt;
+			for_array(func->normal.stmts, stmt) {
+				bool returned = eval_stmt(ir, frame, stmt, &return_value);
+				if (returned) break;
 			}
 		}
 
-		pop_scope(ir);
+		if (!ir->tail_call) break;
+
+		// 'return f(...)', move the callee and its arguments down over this
+		// frame and run it in place of the current call
+		Value *call = ir->tail_call;
+		ir->tail_call = 0;
+		ir->tail_calls++;
+		args.size = ir->tail_argc;
+		is_method_call = ir->tail_is_method_call;
+		memmove(frame - 1, call, (args.size + 1) * sizeof(Value));
+		func = as_function(frame[-1]);
+		ir->callstack.data[ir->callstack.size - 1].func = func;
+		return_value = null_value;
 	}
 
+	ir->stack_top = top;
 	return return_value;
 }
 
-Value* call_function(Ir *ir, Value *func_value, ValueArray args, bool is_method_call) {
-	assert(func_value->kind == VALUE_FUNCTION);
+Value call_function(Ir *ir, Value func_value, ValueArray args, bool is_method_call) {
+	assert(isfunction(func_value));
 
-	Value *return_value = null_value;
+	Value return_value = null_value;
 
-	Function func = func_value->func;
-	StackCall call = { 0 };
-	call.loc = func.loc;
-	call.kind = func.kind;
-	call.name = make_string_copy(func.name);
-	push_call(ir, call);
-	switch (func.kind) {
+	Function *func = as_function(func_value);
+	push_call(ir, func);
+	switch (func->kind) {
 	case FUNCTION_NORMAL: {
-		return_value = eval_function(ir, func, args, is_method_call);
+		return_value = eval_function(ir, func_value, args, is_method_call);
 	} break;
 	case FUNCTION_NATIVE: {
-		assert(func.native.function);
-		return_value = (*func.native.function)(ir, args);
+		assert(func->native.function);
+		return_value = (*func->native.function)(ir, args);
 	} break;
 	case FUNCTION_FFI: {
 		assert(!"Not implemented");
@@ -1706,69 +2782,65 @@ Value* call_function(Ir *ir, Value *func_value, ValueArray args, bool is_method_
 	return return_value;
 }
 
-Value* eval_unary(Ir *ir, Scope *scope, TokenKind op, Value *v) {
-	Value *res = alloc_value(ir);
-	res->kind = VALUE_NUMBER;
-	Value *rhs = eval_value(ir, scope, v->unary.v);
+Value eval_unary(Ir *ir, TokenKind op, Value rhs) {
 	if (!isnumber(rhs)) {
 		ir_error(ir, "Unary operators only work with numbers.");
 	}
+	double n = as_number(rhs);
 	switch (op) {
-	case TOKEN_PLUS: {
-		res->number.value = +rhs->number.value;
-	} break;
-	case TOKEN_MINUS: {
-		res->number.value = -rhs->number.value;
-	} break;
-	case TOKEN_NOT: {
-		res->number.value = !rhs->number.value;
-	} break;
+	case TOKEN_PLUS:  return make_number_value(ir, +n);
+	case TOKEN_MINUS: return make_number_value(ir, -n);
+	case TOKEN_NOT:   return make_number_value(ir, !n);
 	default: {
 		assert(!"Invalid unary op");
 		exit(1);
 	} break;
 	}
-
-	return res;
 }
 
-Value* eval_number_op(Ir *ir, Scope *scope, TokenKind op, Value *lhs, Value *rhs) {
-	Value *v = alloc_value(ir);
-	v->kind = VALUE_NUMBER;
+Value eval_number_op(Ir *ir, TokenKind op, Value lhs, Value rhs) {
+	double a = as_number(lhs);
+	double b = as_number(rhs);
+	double n = 0;
 	switch (op) {
-	case TOKEN_PLUS:     v->number.value = lhs->number.value + rhs->number.value; break;
-	case TOKEN_MINUS:    v->number.value = lhs->number.value - rhs->number.value; break;
-	case TOKEN_ASTERISK: v->number.value = lhs->number.value * rhs->number.value; break;
-	case TOKEN_SLASH:    v->number.value = lhs->number.value / rhs->number.value; break;
-	case TOKEN_MOD:      v->number.value = fmod(lhs->number.value, rhs->number.value); break;
-	case TOKEN_EQUALS:   v->number.value = lhs->number.value == rhs->number.value; break;
-	case TOKEN_LT:       v->number.value = lhs->number.value < rhs->number.value; break;
-	case TOKEN_LTE:      v->number.value = lhs->number.value <= rhs->number.value; break;
-	case TOKEN_GT:       v->number.value = lhs->number.value > rhs->number.value; break;
-	case TOKEN_GTE:      v->number.value = lhs->number.value >= rhs->number.value; break;
-	case TOKEN_NE:       v->number.value = lhs->number.value != rhs->number.value; break;
-	case TOKEN_LAND:     v->number.value = lhs->number.value && rhs->number.value; break;
-	case TOKEN_LOR:      v->number.value = lhs->number.value || rhs->number.value; break;
+	case TOKEN_PLUS:     n = a + b; break;
+	case TOKEN_MINUS:    n = a - b; break;
+	case TOKEN_ASTERISK: n = a * b; break;
+	case TOKEN_SLASH:    n = a / b; break;
+	case TOKEN_MOD:      n = fmod(a, b); break;
+	case TOKEN_EQUALS:   n = a == b; break;
+	case TOKEN_LT:       n = a < b; break;
+	case TOKEN_LTE:      n = a <= b; break;
+	case TOKEN_GT:       n = a > b; break;
+	case TOKEN_GTE:      n = a >= b; break;
+	case TOKEN_NE:       n = a != b; break;
+	case TOKEN_LAND:     n = a && b; break;
+	case TOKEN_LOR:      n = a || b; break;
 	default: {
 		assert(!"Unimplemented binary op");
 	}
 	}
-	return v;
+	return make_number_value(ir, n);
+}
+
+// Operands of && and || must be numbers, returns whether v is true
+bool eval_logical_operand(Ir *ir, TokenKind op, Value v) {
+	if (!isnumber(v)) {
+		ir_error(ir, "Operator '%s' is only allowed with numbers", token_kind_to_string(op));
+	}
+	return as_number(v) != 0;
 }
 
-Value* eval_binop(Ir *ir, Scope *scope, TokenKind op, Value *lhs, Value *rhs) {
+Value eval_binop(Ir *ir, TokenKind op, Value lhs, Value rhs) {
 	switch (op) {
 	case TOKEN_PLUS: {
 		if (isnumber(lhs)) {
 			if (!isnumber(rhs)) {
 				ir_error(ir, "Operator '%s' only work with numbers and strings.", token_kind_to_string(op));
 			}
-			Value *v = alloc_value(ir);
-			v->kind = VALUE_NUMBER;
-			v->number.value = lhs->number.value + rhs->number.value;
-			return v;
+			return make_number_value(ir, as_number(lhs) + as_number(rhs));
 		}
-		else if(lhs->kind== VALUE_STRING) {
+		else if(isstring(lhs)) {
 			// If lhs is a string we concat multiple strings and conver the rhs if its a number
 			ir_error(ir, "String concatination is not yet implemented!");
 		}
@@ -1785,7 +2857,7 @@ Value* eval_binop(Ir *ir, Scope *scope, TokenKind op, Value *lhs, Value *rhs) {
 			ir_error(ir, "Operator '%s' is only allowed with numbers", token_kind_to_string(op));
 		}
 		else {
-			return eval_number_op(ir, scope, op, lhs, rhs);
+			return eval_number_op(ir, op, lhs, rhs);
 		}
 	} break;
 
@@ -1798,7 +2870,7 @@ Value* eval_binop(Ir *ir, Scope *scope, TokenKind op, Value *lhs, Value *rhs) {
 		if (!isnumber(lhs) || !isnumber(rhs)) {
 			ir_error(ir, "Operator '%s' is only allowed with numbers", token_kind_to_string(op));
 		}
-		return eval_number_op(ir, scope, op, lhs, rhs);
+		return eval_number_op(ir, op, lhs, rhs);
 	} break;
 
 	case TOKEN_EQUALS: {
@@ -1806,19 +2878,13 @@ Value* eval_binop(Ir *ir, Scope *scope, TokenKind op, Value *lhs, Value *rhs) {
 			if (!isstring(rhs)) {
 				ir_error(ir, "Cannot compare string to rhs!");
 			}
-			Value *v = alloc_value(ir);
-			v->kind = VALUE_NUMBER;
-			v->number.value = strings_match(lhs->string.str, rhs->string.str);
-			return v;
+			return make_number_value(ir, lhs == rhs);
 		}
 		else {
 			if (!isnumber(lhs) || !isnumber(rhs)) {
 				ir_error(ir, "Operator '%s' only works with numbers and strings", token_kind_to_string(op));
 			}
-			Value *v = alloc_value(ir);
-			v->kind = VALUE_NUMBER;
-			v->number.value = lhs->number.value == rhs->number.value;
-			return v;
+			return make_number_value(ir, as_number(lhs) == as_number(rhs));
 		}
 	} break;
 	case TOKEN_NE: {
@@ -1826,19 +2892,13 @@ Value* eval_binop(Ir *ir, Scope *scope, TokenKind op, Value *lhs, Value *rhs) {
 			if (!isstring(rhs)) {
 				ir_error(ir, "Can only compare strings with strings.");
 			}
-			Value *v = alloc_value(ir);
-			v->kind = VALUE_NUMBER;
-			v->number.value = !strings_match(lhs->string.str, rhs->string.str);
-			return v;
+			return make_number_value(ir, lhs != rhs);
 		}
 		else {
 			if (!isnumber(lhs) || !isnumber(rhs)) {
 				ir_error(ir, "Operator '%s' only works with strings and numbers.", token_kind_to_string(op));
 			}
-			Value *v = alloc_value(ir);
-			v->kind = VALUE_NUMBER;
-			v->number.value = lhs->number.value != rhs->number.value;
-			return v;
+			return make_number_value(ir, as_number(lhs) != as_number(rhs));
 		}
 	} break;
 	
@@ -1851,91 +2911,87 @@ Value* eval_binop(Ir *ir, Scope *scope, TokenKind op, Value *lhs, Value *rhs) {
 	exit(1);
 }
 
-Value* eval_value(Ir *ir, Scope *scope, Value *v) {
+Value eval_value(Ir *ir, Value *frame, Expr *v) {
 	switch (v->kind) {
-	case VALUE_NAME: {
-		Value *var = scope_get(ir, scope, v->name.name);
-		assert(var); // scope_get should complain about missing symbols
-		return eval_value(ir, scope, var);
-	} break;
-	case VALUE_BINOP: {
-		Value *lhs = eval_value(ir, scope, v->binary.lhs);
-		Value *rhs = eval_value(ir, scope, v->binary.rhs);
-		return eval_binop(ir, scope, v->binary.op, lhs, rhs);
-	} break;
-	case VALUE_UNARY: {
-		return eval_unary(ir, scope, v->unary.op, v);
-	} break;
-	case VALUE_CALL: {
-		Value *func = eval_value(ir, scope, v->call.expr);
-		assert(func->kind == VALUE_FUNCTION);
-		if (!isfunction(func)) {
-			ir_error(ir, "Tried to call non-function value");
-		}
-		ValueArray args = { 0 };
-		if (v->call.args.size > 0) {
-			Value *arg;
-			for_array(v->call.args, arg) {
-				Value *v = eval_value(ir, scope, arg);
-				array_add(args, v);
+	case EXPR_CONSTANT: {
+		return v->constant.value;
+	} break;
+	case EXPR_NAME: {
+		if (v->name.local) {
+			return frame[v->name.slot];
+		}
+		return global_get(ir, v->name.slot);
+	} break;
+	case EXPR_BINOP: {
+		TokenKind op = v->binary.op;
+		if (op == TOKEN_LAND || op == TOKEN_LOR) {
+			// The right hand side only runs if the left does not decide the result
+			bool lhs = eval_logical_operand(ir, op, eval_value(ir, frame, v->binary.lhs));
+			if (lhs == (op == TOKEN_LOR)) {
+				return make_number_value(ir, lhs);
 			}
-		}
-		Value *ret = eval_value(ir, scope, call_function(ir, func, args, false));
-		array_free(args);
+			return make_number_value(ir, eval_logical_operand(ir, op, eval_value(ir, frame, v->binary.rhs)));
+		}
+		Value lhs = eval_value(ir, frame, v->binary.lhs);
+		if (isobject(lhs)) {
+			push_temp(ir, lhs);
+			Value rhs = eval_value(ir, frame, v->binary.rhs);
+			ir->stack_top--;
+			return eval_binop(ir, op, lhs, rhs);
+		}
+		Value rhs = eval_value(ir, frame, v->binary.rhs);
+		return eval_binop(ir, op, lhs, rhs);
+	} break;
+	case EXPR_UNARY: {
+		Value rhs = eval_value(ir, frame, v->unary.v);
+		return eval_unary(ir, v->unary.op, rhs);
+	} break;
+	case EXPR_CALL:
+	case EXPR_METHOD_CALL: {
+		size_t argc;
+		Value *base = eval_call_args(ir, frame, v, &argc);
+		ValueArray args = { base + 1, argc, argc };
+		Value ret = call_function(ir, *base, args, v->kind == EXPR_METHOD_CALL);
+		ir->stack_top = base;
 		return ret;
 	} break;
-	case VALUE_METHOD_CALL: {
-		Value *table = eval_value(ir, scope, v->method_call.expr);
-		if (!istable(table)) {
-			ir_error(ir, "':' operator only works with tables as lvalues");
-		}
-
-		Value *func = table_get_name(ir, table, v->method_call.name); // Should return null for non existing values
-		if (!func) {
-			ir_error(ir, "Table does not contain any value called: %.*s", (int)v->method_call.name.len, v->method_call.name.str);
-		}
-		if (!isfunction(func)) {
-			ir_error(ir, "Right hand side of ':' operator is not a function");
-		}
-
-		ValueArray args = { 0 };
-		array_add(args, table);
-		if (v->method_call.args.size > 0) {
-			Value *arg;
-			for_array(v->method_call.args, arg) {
-				Value *v = eval_value(ir, scope, arg);
-				array_add(args, v);
+	case EXPR_TABLE: {
+		if (v->table.template) {
+			// The stack keeps the values alive while the rest are evaluated
+			Value *values = ir->stack_top;
+			if (values + v->table.entries.size > ir->stack + VM_STACK_SIZE) {
+				ir_error(ir, "Stack overflow!");
+			}
+			ExprTableEntry *e;
+			for_array_ref(v->table.entries, e) {
+				Value entry = eval_value(ir, frame, e->expr);
+				*ir->stack_top++ = entry;
 			}
+			Value t = make_table_from_template(ir, v->table.template, values);
+			ir->stack_top = values;
+			return t;
 		}
 
-		Value *result = call_function(ir, func, args, true);
-		array_free(args);
-		return eval_value(ir, scope, result);
-	} break;
-	case VALUE_TABLE_CONSTANT: {
-		Value *t = alloc_value(ir);
-		t->kind = VALUE_TABLE;
+		Value t = make_table_value(ir);
+		table_array_reserve(ir, as_object(t), v->table.array_count);
+		push_temp(ir, t);
 
-		if (v->table_constant.entries.size > 0) {
+		if (v->table.entries.size > 0) {
 			size_t index = 0;
-			TableEntry *e;
-			for_array_ref(v->table_constant.entries, e) {
+			ExprTableEntry *e;
+			for_array_ref(v->table.entries, e) {
 				switch (e->kind) {
 				case ENTRY_NORMAL: {  // v
-					table_put(ir, t, make_number_value(ir, (double)index), eval_value(ir, scope, expr_to_value(ir, e->expr)));
+					table_put(ir, t, make_number_value(ir, (double)index), eval_value(ir, frame, e->expr));
 					index++;
 				} break;
-				case ENTRY_INDEX: { // [blah] = v
-					Value *index = eval_value(ir, scope, expr_to_value(ir, e->index));
+				case ENTRY_INDEX:   // [blah] = v
+				case ENTRY_KEY: {   // name = v
+					Value index = eval_value(ir, frame, e->key);
 					//TODO: Handle null index
-					table_put(ir, t, index, eval_value(ir, scope, expr_to_value(ir, e->expr)));
-				} break;
-				case ENTRY_KEY: {     // name = v
-					Value *name = expr_to_value(ir, e->key);
-					if (!isname(name) && !isstring(name)) {
-						ir_error(ir, "Expected left hand side of assignment to be a name or string!");
-					}
-					table_put(ir, t, name, eval_value(ir, scope, expr_to_value(ir, e->expr)));
+					push_temp(ir, index);
+					table_put(ir, t, index, eval_value(ir, frame, e->expr));
+					ir->stack_top--;
 				} break;
 
 				default: {
@@ -1946,141 +3002,159 @@ Value* eval_value(Ir *ir, Scope *scope, Value *v) {
 			}
 		}
 
+		ir->stack_top--;
 		return t;
 	} break;
-	case VALUE_INDEX: {
-		Value *expr = eval_value(ir, scope, v->index.expr);
+	case EXPR_INDEX: {
+		Value expr = eval_value(ir, frame, v->index.expr);
 		if (!istable(expr)) {
 			ir_error(ir, "Left hand side of '[]' operator is not a table!");
 		}
 
-		Value *index = eval_value(ir, scope, v->index.index);
+		push_temp(ir, expr);
+		Value index = eval_value(ir, frame, v->index.index);
+		ir->stack_top--;
 		//TODO: Where do we handle a null index?
 
-		Value *table_value = table_get(ir, expr, index);
+		Value table_value = table_get(ir, expr, index);
 		if (table_value) {
-			return eval_value(ir, scope, table_value);
+			return table_value;
 		}
 		else {
 			return null_value;
 		}
 		
 	} break;
-	case VALUE_FIELD: {
-		Value *expr = eval_value(ir, scope, v->field.expr);
+	case EXPR_FIELD: {
+		Value expr = eval_value(ir, frame, v->field.expr);
 		if (!istable(expr)) {
 			ir_error(ir, "Left hand side of '.' it not a table!");
 		}
 
-		Value *table_value = table_get_name(ir, expr, v->field.name);
+		Value table_value = table_get_cached(ir, expr, v->field.name, v->field.cache);
 		if (table_value) {
-			return eval_value(ir, scope, table_value);
+			return table_value;
 		}
 		else {
 			return null_value;
 		}
 	} break;
-	case VALUE_INCDEC: {
-		Value *lhs = v->incdec.expr;
-		if (lhs->kind != VALUE_NAME && lhs->kind != VALUE_FIELD && lhs->kind != VALUE_INDEX) {
+	case EXPR_INCDEC: {
+		Expr *lhs = v->incdec.expr;
+		if (!is_assignable_expr(lhs)) {
 			// Error not supported assignemtn or something else?
-			lhs = eval_value(ir, scope, v->incdec.expr);
-		}
-		if (lhs->kind != VALUE_NAME && lhs->kind != VALUE_FIELD && lhs->kind != VALUE_INDEX) {
+			eval_value(ir, frame, lhs);
 			ir_error(ir, "Cannot assign to left hand");
 		}
 
-		Value *lhs_value = eval_value(ir, scope, lhs);
-		Value *to_assign = 0;
+		Value lhs_value = eval_value(ir, frame, lhs);
+		Value to_assign = 0;
 		if (v->incdec.op == TOKEN_INCREMENT) {
-			to_assign = eval_binop(ir, scope, TOKEN_PLUS, lhs_value, make_number_value(ir, 1));
+			to_assign = eval_binop(ir, TOKEN_PLUS, lhs_value, make_number_value(ir, 1));
 		}
 		else if (v->incdec.op == TOKEN_INCREMENT) {
-			to_assign = eval_binop(ir, scope, TOKEN_MINUS, lhs_value, make_number_value(ir, 1));
+			to_assign = eval_binop(ir, TOKEN_MINUS, lhs_value, make_number_value(ir, 1));
 		}
 		else {
 			assert(!"Invalid incdec op");
 		}
 
-		Value *result = 0;
+		Value result = 0;
 		if (v->incdec.post) {
-			result = eval_value(ir, scope, lhs);
+			result = eval_value(ir, frame, lhs);
 		}
 		else {
-			result = eval_value(ir, scope, to_assign);
+			result = to_assign;
 		}
 
-		do_assign(ir, scope, lhs, to_assign);
+		// The new value is a number, a temporary expression is enough to assign it
+		Expr constant = { .kind = EXPR_CONSTANT, .constant.value = to_assign };
+		do_assign(ir, frame, lhs, &constant);
 
 		return result;
 	} break;
 	default: {
-		return v;
+		assert(!"Unhandled expr kind!");
+		exit(1);
 	} break;
 	}
 }
 
-Value* expr_to_value(Ir *ir, Node *n) {
+Expr* expr_to_value(Ir *ir, Node *n) {
 	switch (n->kind) {
 	case NODE_NULL: {
-		return null_value;
+		return make_literal_expr(ir, null_value);
 	} break;
 	case NODE_NUMBER: {
-		Value *v = alloc_value(ir);
-		v->kind = VALUE_NUMBER;
-		v->number.value = n->number.value;
-		return v;
+		return make_literal_expr(ir, make_number_value(ir, n->number.value));
 	} break;
 	case NODE_STRING: {
-		Value *v = alloc_value(ir);
-		v->kind = VALUE_STRING;
-		v->string.str = make_string_copy(n->string.string);
-		return v;
+		return make_literal_expr(ir, intern_string(ir, n->string.string));
 	} break;
 	case NODE_NAME: {
-		Value *v = alloc_value(ir);
-		v->kind = VALUE_NAME;
+		Expr *v = alloc_expr(ir, EXPR_NAME);
 		v->name.name = make_string_copy(n->name.name);
+		int slot = ir->resolver ? resolve_local(ir->resolver, n->name.name) : -1;
+		if (slot >= 0) {
+			v->name.local = true;
+			v->name.slot = slot;
+		}
+		else {
+			v->name.slot = global_slot(ir, n->name.name);
+		}
 		return v;
 	} break;
 	case NODE_TABLE: {
-		Value *v = alloc_value(ir);
-		v->kind = VALUE_TABLE_CONSTANT;
-		v->table_constant.entries = n->table.entries;
+		Expr *v = alloc_expr(ir, EXPR_TABLE);
+		TableEntry *e;
+		for_array_ref(n->table.entries, e) {
+			ExprTableEntry entry = { 0 };
+			entry.kind = e->kind;
+			switch (e->kind) {
+			case ENTRY_NORMAL: {
+				v->table.array_count++;
+			} break;
+			case ENTRY_INDEX: {
+				entry.key = expr_to_value(ir, e->index);
+			} break;
+			case ENTRY_KEY: {
+				entry.key = make_literal_expr(ir, intern_string(ir, table_entry_name(ir, e)));
+			} break;
+			}
+			entry.expr = expr_to_value(ir, e->expr);
+			array_add(v->table.entries, entry);
+		}
+		v->table.template = make_table_template(ir, n);
 		return v;
 	} break;
 	case NODE_BINOP: {
-		Value *v = alloc_value(ir);
-		v->kind = VALUE_BINOP;
+		Expr *v = alloc_expr(ir, EXPR_BINOP);
 		v->binary.op = n->binary.op;
 		v->binary.lhs = expr_to_value(ir, n->binary.lhs);
 		v->binary.rhs = expr_to_value(ir, n->binary.rhs);
 		return v;
 	} break;
 	case NODE_UNARY: {
-		Value *v = alloc_value(ir);
-		v->kind = VALUE_UNARY;
+		Expr *v = alloc_expr(ir, EXPR_UNARY);
 		v->unary.op = n->unary.op;
 		v->unary.v = expr_to_value(ir, n->unary.rhs);
 		return v;
 	} break;
 	case NODE_FIELD: {
-		Value *v = alloc_value(ir);
-		v->kind = VALUE_FIELD;
+		Expr *v = alloc_expr(ir, EXPR_FIELD);
 		v->field.expr = expr_to_value(ir, n->field.expr);
-		v->field.name = make_string_copy(n->field.name);
+		v->field.name = make_literal(ir, intern_string(ir, n->field.name));
+		v->field.cache = calloc(1, sizeof(InlineCache));
 		return v;
 	} break;
 	case NODE_INDEX: {
-		Value *v = alloc_value(ir);
-		v->kind = VALUE_INDEX;
+		Expr *v = alloc_expr(ir, EXPR_INDEX);
 		v->index.expr = expr_to_value(ir, n->index.expr);
 		v->index.index = expr_to_value(ir, n->index.index);
 		return v;
 	} break;
 	case NODE_CALL: {
-		Value *v = alloc_value(ir);
-		v->kind = VALUE_CALL;
+		Expr *v = alloc_expr(ir, EXPR_CALL);
 		v->call.expr = expr_to_value(ir, n->call.expr);
 		if (n->call.args.size > 0) {
 			Node *arg;
@@ -2091,10 +3165,10 @@ Value* expr_to_value(Ir *ir, Node *n) {
 		return v;
 	} break;
 	case NODE_METHOD_CALL: {
-		Value *v = alloc_value(ir);
-		v->kind = VALUE_METHOD_CALL;
+		Expr *v = alloc_expr(ir, EXPR_METHOD_CALL);
 		v->method_call.expr = expr_to_value(ir, n->method_call.expr);
-		v->method_call.name = make_string_copy(n->method_call.name);
+		v->method_call.name = make_literal(ir, intern_string(ir, n->method_call.name));
+		v->method_call.cache = calloc(1, sizeof(InlineCache));
 		if (n->method_call.args.size > 0) {
 			Node *arg;
 			for_array(n->method_call.args, arg) {
@@ -2104,24 +3178,18 @@ Value* expr_to_value(Ir *ir, Node *n) {
 		return v;
 	} break;
 	case NODE_ANON_FUNC: {
-		Value *v = alloc_value(ir);
-		v->kind = VALUE_FUNCTION;
-		v->func.kind = FUNCTION_NORMAL;
-		v->func.name = make_string_slow("<anonymous func>");
-		v->func.loc = n->loc;
-
+		StringArray arg_names = { 0 };
 		if (n->anon_func.args.size > 0) {
 			String *str;
 			for_array_ref(n->anon_func.args, str) {
-				array_add(v->func.normal.arg_names, make_string_slow_len(str->str, str->len));
+				array_add(arg_names, make_string_slow_len(str->str, str->len));
 			}
 		}
-		v->func.normal.stmts = convert_nodes_to_stmts(ir, n->anon_func.block->block.stmts);
-		return v;
+		Value f = make_function_value(ir, string("<anonymous func>"), n->loc, arg_names, n->anon_func.block);
+		return make_literal_expr(ir, f);
 	} break;
 	case NODE_INCDEC: {
-		Value *v = alloc_value(ir);
-		v->kind = VALUE_INCDEC;
+		Expr *v = alloc_expr(ir, EXPR_INCDEC);
 		v->incdec.expr = expr_to_value(ir, n->incdec.expr);
 		v->incdec.op = n->incdec.op;
 		v->incdec.post = n->incdec.post;
@@ -2134,10 +3202,9 @@ Value* expr_to_value(Ir *ir, Node *n) {
 	}
 }
 
-Value* ir_run(Ir *ir, size_t argc, char **argv) {
+Value ir_run(Ir *ir, size_t argc, char **argv) {
 	ValueArray args = { 0 };
-	Value *arg_table = alloc_value(ir);
-	arg_table->kind = VALUE_TABLE;
+	Value arg_table = make_table_value(ir);
 	array_add(args, arg_table);
 
 	if (argc > 0) {
@@ -2147,6 +3214,16 @@ Value* ir_run(Ir *ir, size_t argc, char **argv) {
 			}
 		}
 	}
-	Value *main_func = scope_get(ir, ir->file_scope, string("main"));
-	return call_function(ir, main_func, args, false);
+	Value main_func = global_get(ir, global_slot(ir, string("main")));
+	Value result;
+	if (ir->use_tree_walker) {
+		result = call_function(ir, main_func, args, false);
+	}
+	else {
+		result = vm_call(ir, main_func, args);
+	}
+
+	// The sweeper may still be using the ir, which goes away once main returns
+	gc_finish_sweep(ir);
+	return result;
 }
@@ -13,7 +13,9 @@
 #include "timings.c"
 #include "lexer.c"
 #include "parser.c"
+#include "optimize.c"
 #include "ir.c"
+#include "vm.c"
 #include "gfx.c"
 #include "runtime.c"
 
@@ -21,13 +23,40 @@ void print_usage(char *binary_name) {
 	printf("Usage: %s [options] <script> [script arguments]\n", binary_name);
 	printf("\nOptions:\n");
 	printf("\t-h/-help - Prints out program usage\n");
-	printf("\t-timings - Prints timing information\n");
+	printf("\t-timings - Prints timing information and inline cache hits/misses\n");
+	printf("\t-gcstats - Prints what the gc did: collections, objects freed, mark and sweep time, longest pause and live buckets\n");
 	printf("\t-silent  - Suppresses all output\n");
+	printf("\t-treewalk - Runs the script with the old tree-walking evaluator instead of the bytecode VM\n");
+	printf("\t-dump-ir - Prints every file as it looks after constant folding before running it\n");
+	printf("\t-gc-step <percent> - How many bytes the gc scans per byte allocated, higher means fewer but longer pauses, must be above 100 (default 200)\n");
+	printf("\t-gc-pause <percent> - How much the heap grows before the gc starts scanning again, 100 means right away (default 200)\n");
+	printf("\t-gc-threads <count> - Marks each major collection in one go on this many threads (default 1, incremental)\n");
+	printf("\t-gc-compact - Moves objects out of mostly empty buckets so their memory can be given back\n");
+}
+
+// Reads the value of an option like -gc-step 200
+int parse_number_option(char *name, int argc, char **argv, size_t *i) {
+	int n = 0;
+	if (*i + 1 < argc) {
+		n = atoi(argv[++*i]);
+	}
+	if (n <= 0) {
+		printf("Option '%s' needs a positive number!\n", name);
+		exit(1);
+	}
+	return n;
 }
 
 int main(int argc, char **argv) {
 	bool print_timings = false;
+	bool print_gc_stats = false;
 	bool silence = false;
+	bool tree_walk = false;
+	bool dump_ir = false;
+	int gc_step_mul = 0;
+	int gc_pause = 0;
+	int gc_threads = 0;
+	bool gc_compact = false;
 	char* binary_name = argv[0];
 
 	String filename = {0};
@@ -40,9 +69,35 @@ int main(int argc, char **argv) {
 			if (strcmp(name, "timings") == 0) {
 				print_timings = true;
 			}
+			else if (strcmp(name, "gcstats") == 0) {
+				print_gc_stats = true;
+			}
 			else if (strcmp(name, "silent") == 0) {
 				silence = true;
 			}
+			else if (strcmp(name, "treewalk") == 0) {
+				tree_walk = true;
+			}
+			else if (strcmp(name, "dump-ir") == 0) {
+				dump_ir = true;
+			}
+			else if (strcmp(name, "gc-step") == 0) {
+				gc_step_mul = parse_number_option(name, argc, argv, &last_arg);
+				if (gc_step_mul <= 100) {
+					printf("Option '%s' needs to be above 100, or the gc can fall behind allocation and never finish a cycle!\n", name);
+					exit(1);
+				}
+			}
+			else if (strcmp(name, "gc-pause") == 0) {
+				gc_pause = parse_number_option(name, argc, argv, &last_arg);
+				if (gc_pause < 100) gc_pause = 100;
+			}
+			else if (strcmp(name, "gc-threads") == 0) {
+				gc_threads = parse_number_option(name, argc, argv, &last_arg);
+			}
+			else if (strcmp(name, "gc-compact") == 0) {
+				gc_compact = true;
+			}
 			else if (strcmp(name, "help") == 0 || strcmp(name, "h") == 0) {
 				print_usage(binary_name);
 				exit(0);
@@ -87,23 +142,46 @@ int main(int argc, char **argv) {
 	init_parser(&p, filename);
 	timings_start_section(&t, make_string_slow("parser"));
 	NodeArray stmts = parse(&p);
+	timings_start_section(&t, make_string_slow("optimize"));
+	optimize(stmts);
+	if (dump_ir) {
+		printf("// %.*s\n", (int)filename.len, filename.str);
+		dump_nodes(stmts);
+	}
 
 	timings_start_section(&t, make_string_slow("ir"));
 	Ir ir = { 0 };
 	memset(&ir, 0, sizeof(Ir));
+	ir.use_tree_walker = tree_walk;
+	ir.dump_ir = dump_ir;
+	ir.gc_step_mul = gc_step_mul;
+	ir.gc_pause = gc_pause;
+	ir.gc_threads = gc_threads;
+	ir.gc_compact = gc_compact;
 	init_ir(&ir, stmts);
 
 	timings_start_section(&t, make_string_slow("ir run"));
 
-	Value *return_value = ir_run(&ir, argc-last_arg, argv+last_arg);
+	Value return_value = ir_run(&ir, argc-last_arg, argv+last_arg);
 
 	if (print_timings) {
 		printf("\n");
 		timings_print_all(&t, TimingUnit_Millisecond);
+		printf("inline caches: %llu hits, %llu misses\n", (unsigned long long)ir.ic_hits, (unsigned long long)ir.ic_misses);
+		printf("tail calls: %llu\n", (unsigned long long)ir.tail_calls);
+		printf("immortal literals: %llu\n", (unsigned long long)ir.immortal_count);
+		printf("gc: %llu minor, %llu major collections, %.3f ms major marking\n", (unsigned long long)ir.minor_collections, (unsigned long long)ir.major_collections, 1000.0 * ir.gc_mark_time / time_stamp_freq());
+		if (ir.gc_compact) {
+			printf("gc compaction: %llu runs, %llu objects moved\n", (unsigned long long)ir.compactions, (unsigned long long)ir.objects_moved);
+		}
 	}	
+	if (print_gc_stats) {
+		printf("\n");
+		gc_print_stats(&ir);
+	}
 	
-	if (return_value->kind == VALUE_NUMBER) {
-		return return_value->number.value;
+	if (isnumber(return_value)) {
+		return (int)as_number(return_value);
 	}
 	else {
 		return 0;
@@ -0,0 +1,441 @@
+// Optimization pass over the parsed nodes, runs after parse() and before the
+// nodes are converted for the tree walker or compiled for the VM.
+//
+// Folds constant arithmetic, comparisons and logic, removes branches and
+// loops whose condition is a constant, and drops identities like x * 1
+// when x is known to be a number. Anything that could produce a runtime
+// error is left alone so scripts fail the same way they did before.
+
+Node* optimize_expr(Node *n);
+Node* optimize_stmt(Node *n);
+
+bool is_constant_number(Node *n) {
+	return n->kind == NODE_NUMBER;
+}
+
+// Operators and literals can only produce numbers, or error on other operands
+bool is_numeric(Node *n) {
+	return n->kind == NODE_NUMBER || n->kind == NODE_BINOP || n->kind == NODE_UNARY;
+}
+
+Node* fold_to_number(Node *n, double value) {
+	if (isnan(value)) {
+		// NaN is not a literal we can give back to the parser's number nodes
+		return n;
+	}
+	n->kind = NODE_NUMBER;
+	n->number.value = value;
+	return n;
+}
+
+// Matches eval_number_op and eval_unary, returns false if op has no constant result
+bool fold_number_op(TokenKind op, double a, double b, double *result) {
+	switch (op) {
+	case TOKEN_PLUS:     *result = a + b; break;
+	case TOKEN_MINUS:    *result = a - b; break;
+	case TOKEN_ASTERISK: *result = a * b; break;
+	case TOKEN_SLASH:    *result = a / b; break;
+	case TOKEN_MOD:      *result = fmod(a, b); break;
+	case TOKEN_EQUALS:   *result = a == b; break;
+	case TOKEN_NE:       *result = a != b; break;
+	case TOKEN_LT:       *result = a < b; break;
+	case TOKEN_LTE:      *result = a <= b; break;
+	case TOKEN_GT:       *result = a > b; break;
+	case TOKEN_GTE:      *result = a >= b; break;
+	case TOKEN_LAND:     *result = a && b; break;
+	case TOKEN_LOR:      *result = a || b; break;
+	default: return false;
+	}
+	return true;
+}
+
+bool is_number_value(Node *n, double value) {
+	return n->kind == NODE_NUMBER && n->number.value == value;
+}
+
+Node* optimize_binary(Node *n) {
+	TokenKind op = n->binary.op;
+	Node *lhs = n->binary.lhs = optimize_expr(n->binary.lhs);
+	Node *rhs = n->binary.rhs = optimize_expr(n->binary.rhs);
+
+	if (is_constant_number(lhs) && is_constant_number(rhs)) {
+		double result;
+		if (fold_number_op(op, lhs->number.value, rhs->number.value, &result)) {
+			return fold_to_number(n, result);
+		}
+		return n;
+	}
+
+	// Strings are interned, so comparing two literals is known up front
+	if (lhs->kind == NODE_STRING && rhs->kind == NODE_STRING && (op == TOKEN_EQUALS || op == TOKEN_NE)) {
+		bool equal = strings_match(lhs->string.string, rhs->string.string);
+		return fold_to_number(n, op == TOKEN_EQUALS ? equal : !equal);
+	}
+
+	// A constant left hand side that decides && or || means the right hand
+	// side never runs
+	if (is_constant_number(lhs)) {
+		bool value = lhs->number.value != 0;
+		if (op == TOKEN_LAND && !value) return fold_to_number(n, 0);
+		if (op == TOKEN_LOR && value)   return fold_to_number(n, 1);
+	}
+
+	// Identities, only when the other side is known to be a number as they
+	// would otherwise hide the type error. x + 0 is not one, -0 + 0 is +0,
+	// and neither is x - -0 for the same reason.
+	switch (op) {
+	case TOKEN_MINUS: {
+		if (is_number_value(rhs, 0) && !signbit(rhs->number.value) && is_numeric(lhs)) return lhs;
+	} break;
+	case TOKEN_ASTERISK: {
+		if (is_number_value(rhs, 1) && is_numeric(lhs)) return lhs;
+		if (is_number_value(lhs, 1) && is_numeric(rhs)) return rhs;
+	} break;
+	case TOKEN_SLASH: {
+		if (is_number_value(rhs, 1) && is_numeric(lhs)) return lhs;
+	} break;
+	default: break;
+	}
+
+	return n;
+}
+
+Node* optimize_unary(Node *n) {
+	Node *rhs = n->unary.rhs = optimize_expr(n->unary.rhs);
+	if (!is_constant_number(rhs)) {
+		return n;
+	}
+
+	double v = rhs->number.value;
+	switch (n->unary.op) {
+	case TOKEN_PLUS:  return fold_to_number(n, +v);
+	case TOKEN_MINUS: return fold_to_number(n, -v);
+	case TOKEN_NOT:   return fold_to_number(n, !v);
+	default: break;
+	}
+	return n;
+}
+
+void optimize_args(NodeArray args) {
+	for (size_t i = 0; i < args.size; i++) {
+		args.data[i] = optimize_expr(args.data[i]);
+	}
+}
+
+Node* optimize_expr(Node *n) {
+	switch (n->kind) {
+	case NODE_BINOP: {
+		return optimize_binary(n);
+	} break;
+	case NODE_UNARY: {
+		return optimize_unary(n);
+	} break;
+	case NODE_FIELD: {
+		n->field.expr = optimize_expr(n->field.expr);
+	} break;
+	case NODE_INDEX: {
+		n->index.expr = optimize_expr(n->index.expr);
+		n->index.index = optimize_expr(n->index.index);
+	} break;
+	case NODE_CALL: {
+		n->call.expr = optimize_expr(n->call.expr);
+		optimize_args(n->call.args);
+	} break;
+	case NODE_METHOD_CALL: {
+		n->method_call.expr = optimize_expr(n->method_call.expr);
+		optimize_args(n->method_call.args);
+	} break;
+	case NODE_TABLE: {
+		TableEntry *e;
+		for_array_ref(n->table.entries, e) {
+			e->expr = optimize_expr(e->expr);
+			if (e->kind == ENTRY_INDEX) {
+				e->index = optimize_expr(e->index);
+			}
+		}
+	} break;
+	case NODE_ANON_FUNC: {
+		optimize_stmt(n->anon_func.block);
+	} break;
+	case NODE_INCDEC: {
+		n->incdec.expr = optimize_expr(n->incdec.expr);
+	} break;
+	default: break;
+	}
+	return n;
+}
+
+// Null counts as false in conditions, returns false if cond is not a constant
+bool constant_condition(Node *cond, bool *value) {
+	if (cond->kind == NODE_NUMBER) {
+		*value = cond->number.value != 0;
+		return true;
+	}
+	if (cond->kind == NODE_NULL) {
+		*value = false;
+		return true;
+	}
+	return false;
+}
+
+Node* make_empty_block(Node *n) {
+	n->kind = NODE_BLOCK;
+	memset(&n->block, 0, sizeof(n->block));
+	return n;
+}
+
+Node* optimize_stmt(Node *n) {
+	switch (n->kind) {
+	case NODE_VAR: {
+		if (n->var.expr) {
+			n->var.expr = optimize_expr(n->var.expr);
+		}
+	} break;
+	case NODE_RETURN: {
+		if (n->ret.expr) {
+			n->ret.expr = optimize_expr(n->ret.expr);
+		}
+	} break;
+	case NODE_ASSIGN: {
+		n->assign.left = optimize_expr(n->assign.left);
+		n->assign.right = optimize_expr(n->assign.right);
+	} break;
+	case NODE_IF: {
+		n->_if.cond = optimize_expr(n->_if.cond);
+		optimize_stmt(n->_if.block);
+		if (n->_if.else_block) {
+			n->_if.else_block = optimize_stmt(n->_if.else_block);
+		}
+
+		bool value;
+		if (constant_condition(n->_if.cond, &value)) {
+			if (value) return n->_if.block;
+			if (n->_if.else_block) return n->_if.else_block;
+			return make_empty_block(n);
+		}
+	} break;
+	case NODE_WHILE: {
+		n->_while.cond = optimize_expr(n->_while.cond);
+		optimize_stmt(n->_while.block);
+
+		bool value;
+		if (constant_condition(n->_while.cond, &value) && !value) {
+			return make_empty_block(n);
+		}
+	} break;
+	case NODE_BLOCK: {
+		// Removed branches leave empty blocks behind, those are dropped here
+		size_t count = 0;
+		for (size_t i = 0; i < n->block.stmts.size; i++) {
+			Node *stmt = optimize_stmt(n->block.stmts.data[i]);
+			if (stmt->kind == NODE_BLOCK && stmt->block.stmts.size == 0) {
+				continue;
+			}
+			n->block.stmts.data[count++] = stmt;
+		}
+		n->block.stmts.size = count;
+	} break;
+	case NODE_FUNC: {
+		optimize_stmt(n->func.block);
+	} break;
+	default: {
+		return optimize_expr(n);
+	} break;
+	}
+	return n;
+}
+
+void optimize(NodeArray stmts) {
+	for (size_t i = 0; i < stmts.size; i++) {
+		stmts.data[i] = optimize_stmt(stmts.data[i]);
+	}
+}
+
+void dump_indent(int depth) {
+	for (int i = 0; i < depth; i++) {
+		printf("\t");
+	}
+}
+
+void dump_expr(Node *n);
+
+void dump_args(NodeArray args) {
+	for (size_t i = 0; i < args.size; i++) {
+		if (i > 0) printf(", ");
+		dump_expr(args.data[i]);
+	}
+}
+
+void dump_arg_names(StringArray args) {
+	for (size_t i = 0; i < args.size; i++) {
+		if (i > 0) printf(", ");
+		printf("%.*s", (int)args.data[i].len, args.data[i].str);
+	}
+}
+
+void dump_stmt(Node *n, int depth);
+
+void dump_expr(Node *n) {
+	switch (n->kind) {
+	case NODE_NUMBER: {
+		printf("%.17g", n->number.value);
+	} break;
+	case NODE_NAME: {
+		printf("%.*s", (int)n->name.name.len, n->name.name.str);
+	} break;
+	case NODE_STRING: {
+		printf("\"%.*s\"", (int)n->string.string.len, n->string.string.str);
+	} break;
+	case NODE_NULL: {
+		printf("null");
+	} break;
+	case NODE_BINOP: {
+		printf("(");
+		dump_expr(n->binary.lhs);
+		printf(" %s ", token_kind_to_string(n->binary.op));
+		dump_expr(n->binary.rhs);
+		printf(")");
+	} break;
+	case NODE_UNARY: {
+		printf("%s", token_kind_to_string(n->unary.op));
+		dump_expr(n->unary.rhs);
+	} break;
+	case NODE_FIELD: {
+		dump_expr(n->field.expr);
+		printf(".%.*s", (int)n->field.name.len, n->field.name.str);
+	} break;
+	case NODE_INDEX: {
+		dump_expr(n->index.expr);
+		printf("[");
+		dump_expr(n->index.index);
+		printf("]");
+	} break;
+	case NODE_CALL: {
+		dump_expr(n->call.expr);
+		printf("(");
+		dump_args(n->call.args);
+		printf(")");
+	} break;
+	case NODE_METHOD_CALL: {
+		dump_expr(n->method_call.expr);
+		printf(":%.*s(", (int)n->method_call.name.len, n->method_call.name.str);
+		dump_args(n->method_call.args);
+		printf(")");
+	} break;
+	case NODE_TABLE: {
+		printf("{");
+		for (size_t i = 0; i < n->table.entries.size; i++) {
+			TableEntry *e = &n->table.entries.data[i];
+			if (i > 0) printf(", ");
+			if (e->kind == ENTRY_KEY) {
+				dump_expr(e->key);
+				printf(" = ");
+			}
+			else if (e->kind == ENTRY_INDEX) {
+				printf("[");
+				dump_expr(e->index);
+				printf("] = ");
+			}
+			dump_expr(e->expr);
+		}
+		printf("}");
+	} break;
+	case NODE_ANON_FUNC: {
+		printf("func(");
+		dump_arg_names(n->anon_func.args);
+		printf(") ");
+		dump_stmt(n->anon_func.block, 0);
+	} break;
+	case NODE_INCDEC: {
+		if (!n->incdec.post) printf("%s", token_kind_to_string(n->incdec.op));
+		dump_expr(n->incdec.expr);
+		if (n->incdec.post) printf("%s", token_kind_to_string(n->incdec.op));
+	} break;
+	default: {
+		printf("<%d>", n->kind);
+	} break;
+	}
+}
+
+// Prints n as source, depth is the indentation of the lines after the first
+void dump_stmt(Node *n, int depth) {
+	switch (n->kind) {
+	case NODE_VAR: {
+		printf("var %.*s", (int)n->var.name.len, n->var.name.str);
+		if (n->var.expr) {
+			printf(" = ");
+			dump_expr(n->var.expr);
+		}
+		printf(";");
+	} break;
+	case NODE_RETURN: {
+		printf("return");
+		if (n->ret.expr) {
+			printf(" ");
+			dump_expr(n->ret.expr);
+		}
+		printf(";");
+	} break;
+	case NODE_BREAK: {
+		printf("break;");
+	} break;
+	case NODE_CONTINUE: {
+		printf("continue;");
+	} break;
+	case NODE_ASSIGN: {
+		dump_expr(n->assign.left);
+		printf(" = ");
+		dump_expr(n->assign.right);
+		printf(";");
+	} break;
+	case NODE_IF: {
+		printf("if ");
+		dump_expr(n->_if.cond);
+		printf(" ");
+		dump_stmt(n->_if.block, depth);
+		if (n->_if.else_block) {
+			printf(" else ");
+			dump_stmt(n->_if.else_block, depth);
+		}
+	} break;
+	case NODE_WHILE: {
+		printf("while ");
+		dump_expr(n->_while.cond);
+		printf(" ");
+		dump_stmt(n->_while.block, depth);
+	} break;
+	case NODE_BLOCK: {
+		printf("{\n");
+		for (size_t i = 0; i < n->block.stmts.size; i++) {
+			dump_indent(depth + 1);
+			dump_stmt(n->block.stmts.data[i], depth + 1);
+			printf("\n");
+		}
+		dump_indent(depth);
+		printf("}");
+	} break;
+	case NODE_FUNC: {
+		printf("func %.*s(", (int)n->func.name.len, n->func.name.str);
+		dump_arg_names(n->func.args);
+		printf(") ");
+		dump_stmt(n->func.block, depth);
+	} break;
+	case NODE_IMPORT: {
+		printf("import \"%.*s\";", (int)n->import.name.len, n->import.name.str);
+	} break;
+	case NODE_USE: {
+		printf("use %.*s;", (int)n->use.name.len, n->use.name.str);
+	} break;
+	default: {
+		dump_expr(n);
+		printf(";");
+	} break;
+	}
+}
+
+void dump_nodes(NodeArray stmts) {
+	for (size_t i = 0; i < stmts.size; i++) {
+		dump_stmt(stmts.data[i], 0);
+		printf("\n");
+	}
+}
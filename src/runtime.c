@@ -1,5 +1,5 @@
-Value* runtime_print(Ir *ir, ValueArray args);
-Value* runtime_input(Ir *ir, ValueArray args) {
+Value runtime_print(Ir *ir, ValueArray args);
+Value runtime_input(Ir *ir, ValueArray args) {
 	// Prints a prompt if there is an argument for it and return the user input
 	if (args.size > 0) {
 		runtime_print(ir, args);
@@ -24,7 +24,7 @@ Value* runtime_input(Ir *ir, ValueArray args) {
 	return make_string_value(ir, make_string_slow(buffer));
 }
 
-Value* runtime_input_hidden(Ir *ir, ValueArray args) {
+Value runtime_input_hidden(Ir *ir, ValueArray args) {
 	// Prints a prompt if there is an argument for it and return the user input
 	// Does not echo input
 	if (args.size > 0) {
@@ -49,20 +49,20 @@ Value* runtime_input_hidden(Ir *ir, ValueArray args) {
 	return make_string_value(ir, make_string_slow(buffer));
 }
 
-Value* runtime_type(Ir *ir, ValueArray args) {
+Value runtime_type(Ir *ir, ValueArray args) {
 	// When we have tables(aka array) if the
 	// users passes more than one parameter return an array of strings
 	if (args.size > 1) {
 		assert(!"We dont have these yet!");
-		Value *v;
+		Value v;
 		for_array(args, v) {
 
 		}
 		return null_value;
 	}
 	else if (args.size == 1) {
-		Value *v = args.data[0];
-		switch (v->kind)
+		Value v = args.data[0];
+		switch (value_kind(v))
 		{
 		case VALUE_NUMBER: return make_string_value(ir, make_string_slow("number"));
 		case VALUE_STRING: return make_string_value(ir, make_string_slow("string"));
@@ -78,30 +78,30 @@ Value* runtime_type(Ir *ir, ValueArray args) {
 	}
 }
 
-Value* runtime_println(Ir *ir, ValueArray args) {
+Value runtime_println(Ir *ir, ValueArray args) {
 	runtime_print(ir, args);
 	printf("\n");
 	return null_value;
 }
 
-void print_value(Value *v) {
-	if (v->kind == VALUE_STRING) {
-		printf("%.*s", (int)v->string.str.len, v->string.str.str);
+void print_value(Value v) {
+	if (isstring(v)) {
+		printf("%.*s", (int)as_string(v).len, as_string(v).str);
 	}
-	else if (v->kind == VALUE_NUMBER) {
-		printf("%g", v->number.value);
+	else if (isnumber(v)) {
+		printf("%g", as_number(v));
 	}
-	else if (v->kind == VALUE_NULL) {
+	else if (isnull(v)) {
 		printf("(null)");
 	}
-	else if (v->kind == VALUE_TABLE) {
+	else if (istable(v)) {
 		printf("{}");
 	}
 }
 
-Value* runtime_print(Ir *ir, ValueArray args) {
+Value runtime_print(Ir *ir, ValueArray args) {
 	if (args.size > 0) {
-		Value *v;
+		Value v;
 		for_array(args, v) {
 			print_value(v);
 		}
@@ -110,19 +110,19 @@ Value* runtime_print(Ir *ir, ValueArray args) {
 	return null_value;
 }
 
-Value* runtime_msgbox(Ir *ir, ValueArray args) {
+Value runtime_msgbox(Ir *ir, ValueArray args) {
 #ifdef _WIN32
 #include <windows.h>
 	if (args.size == 1) {
-		Value *arg = args.data[0];
-		if (arg->kind != VALUE_STRING) return null_value;
-		MessageBoxA(0, arg->string.str.str, 0, MB_OK);
+		Value arg = args.data[0];
+		if (!isstring(arg)) return null_value;
+		MessageBoxA(0, as_string(arg).str, 0, MB_OK);
 	}
 	else if (args.size == 2) {
-		Value *arg1 = args.data[0];
-		Value *arg2 = args.data[1];
-		if (arg1->kind != VALUE_STRING || arg2->kind != VALUE_STRING) return null_value;
-		MessageBoxA(0, arg1->string.str.str, arg2->string.str.str, MB_OK);
+		Value arg1 = args.data[0];
+		Value arg2 = args.data[1];
+		if (!isstring(arg1) || !isstring(arg2)) return null_value;
+		MessageBoxA(0, as_string(arg1).str, as_string(arg2).str, MB_OK);
 	}
 	return null_value;
 #else
@@ -130,7 +130,7 @@ Value* runtime_msgbox(Ir *ir, ValueArray args) {
 #endif
 }
 
-Value* runtime_str2num(Ir *ir, ValueArray args) {
+Value runtime_str2num(Ir *ir, ValueArray args) {
 	// When we have table perhabs return an array on multiple args
 	assert(args.size == 1); //TODO: Error message
 	if (args.size != 1) {
@@ -139,17 +139,17 @@ Value* runtime_str2num(Ir *ir, ValueArray args) {
 	if (!isstring(args.data[0])) {
 		return null_value;
 	}
-	//double n = strtod(args.data[0]->string.str.str, 0);
+	//double n = strtod(as_string(args.data[0]).str, 0);
 	double n = 0.0;
-	Value *v = args.data[0];
-	int ret = sscanf(v->string.str.str, "%lf", &n);
+	Value v = args.data[0];
+	int ret = sscanf(as_string(v).str, "%lf", &n);
 	if(ret != 1 || ret == EOF) {
 		return null_value;
 	}
 	return make_number_value(ir, n);
 }
 
-Value* runtime_num2str(Ir *ir, ValueArray args) {
+Value runtime_num2str(Ir *ir, ValueArray args) {
 	// Take second argument specifying precision
 	if (args.size != 1) {
 		ir_error(ir, "num2str only takes one argument");
@@ -158,11 +158,11 @@ Value* runtime_num2str(Ir *ir, ValueArray args) {
 		ir_error(ir, "num2str was called with a non-number");
 	}
 	char buffer[128];
-	snprintf(buffer, 128, "%f", args.data[0]->number.value);
+	snprintf(buffer, 128, "%f", as_number(args.data[0]));
 	return make_string_value(ir, make_string_slow(buffer));
 }
 
-Value* runtime_format(Ir *ir, ValueArray args) {
+Value runtime_format(Ir *ir, ValueArray args) {
 #define FORMAT_BUFFER_SIZE 4096
 	char buffer[FORMAT_BUFFER_SIZE];
 	int offset = 0;
@@ -170,15 +170,15 @@ Value* runtime_format(Ir *ir, ValueArray args) {
 	if (args.size > 0) {
 		//TODO: Split into seperate function runtime__help_snprintf
 		//TODO: Make safer, check return values
-		Value *v;
+		Value v;
 		for_array(args, v) {
-			if (v->kind == VALUE_STRING) {
-				offset += snprintf(buffer + offset, FORMAT_BUFFER_SIZE - offset, "%.*s", (int)v->string.str.len, v->string.str.str);
+			if (isstring(v)) {
+				offset += snprintf(buffer + offset, FORMAT_BUFFER_SIZE - offset, "%.*s", (int)as_string(v).len, as_string(v).str);
 			}
-			else if (v->kind == VALUE_NUMBER) {
-				offset += snprintf(buffer + offset, FORMAT_BUFFER_SIZE - offset, "%f", v->number.value);
+			else if (isnumber(v)) {
+				offset += snprintf(buffer + offset, FORMAT_BUFFER_SIZE - offset, "%f", as_number(v));
 			}
-			else if (v->kind == VALUE_NULL) {
+			else if (isnull(v)) {
 				offset += snprintf(buffer + offset, FORMAT_BUFFER_SIZE - offset, "(null)");
 			}
 		}
@@ -190,46 +190,79 @@ Value* runtime_format(Ir *ir, ValueArray args) {
 	}
 }
 
-Value* runtime_table_len(Ir *ir, ValueArray args) {
+Value runtime_table_len(Ir *ir, ValueArray args) {
 	if(args.size != 1) {
 		ir_error(ir, "len() takes only one argument");
 	}
-	Value *v = args.data[0];
+	Value v = args.data[0];
 	if (!istable(v)) {
 		ir_error(ir, "len() only works on tables");
 	}
 
-	return make_number_value(ir, (double)v->table.map.len);
+	return make_number_value(ir, (double)as_object(v)->table.array_len);
 }
 
-Value* runtime_pow(Ir* ir, ValueArray args) {
+Value runtime_pow(Ir* ir, ValueArray args) {
 	if (args.size != 2) {
 		ir_error(ir, "pow() takes two argument");
 	}
-	Value *n = args.data[0];
-	Value *exp = args.data[1];
+	Value n = args.data[0];
+	Value exp = args.data[1];
 
 	if (!isnumber(n) || !isnumber(exp)) {
 		ir_error(ir, "pow() takes two numbers as arguments");
 	}
 
-	return make_number_value(ir, pow(n->number.value, exp->number.value));
+	return make_number_value(ir, pow(as_number(n), as_number(exp)));
 }
 
-Value* runtime_sqrt(Ir* ir, ValueArray args) {
+Value runtime_sqrt(Ir* ir, ValueArray args) {
 	if (args.size != 1) {
 		ir_error(ir, "sqrt() takes one argument");
 	}
-	Value *n = args.data[0];
+	Value n = args.data[0];
 
 	if (!isnumber(n)) {
 		ir_error(ir, "sqrt() takes one number");
 	}
 
-	return make_number_value(ir, sqrt(n->number.value));
+	return make_number_value(ir, sqrt(as_number(n)));
 }
 
-Value* runtime_hack_force_gc(Ir *ir, ValueArray args) {
+// Returns a table of what the collector has done so far, the same numbers
+// -gcstats prints at exit. Times are in milliseconds.
+Value runtime_gc_stats(Ir *ir, ValueArray args) {
+	if (args.size != 0) {
+		ir_error(ir, "gc_stats() takes no arguments");
+	}
+	double freq = (double)time_stamp_freq();
+	size_t heap_buckets = 0;
+	for (size_t i = 0; i < HEAP_CLASS_COUNT; i++) {
+		heap_buckets += pool_bucket_count(&ir->heap.classes[i]);
+	}
+
+	Value t = make_table_value(ir);
+	table_put_name(ir, t, string("minor_collections"), make_number_value(ir, (double)ir->minor_collections));
+	table_put_name(ir, t, string("major_collections"), make_number_value(ir, (double)ir->major_collections));
+	table_put_name(ir, t, string("compactions"), make_number_value(ir, (double)ir->compactions));
+	table_put_name(ir, t, string("objects_moved"), make_number_value(ir, (double)ir->objects_moved));
+	table_put_name(ir, t, string("objects_allocated"), make_number_value(ir, (double)ir->allocated_values));
+	table_put_name(ir, t, string("minor_freed"), make_number_value(ir, (double)ir->gc_minor_freed));
+	table_put_name(ir, t, string("minor_freed_bytes"), make_number_value(ir, (double)ir->gc_minor_freed_bytes));
+	table_put_name(ir, t, string("major_freed"), make_number_value(ir, (double)ir->gc_major_freed));
+	table_put_name(ir, t, string("major_freed_bytes"), make_number_value(ir, (double)ir->gc_major_freed_bytes));
+	table_put_name(ir, t, string("last_cycle_freed"), make_number_value(ir, (double)ir->gc_last_freed));
+	table_put_name(ir, t, string("last_cycle_freed_bytes"), make_number_value(ir, (double)ir->gc_last_freed_bytes));
+	table_put_name(ir, t, string("mark_ms"), make_number_value(ir, 1000.0 * ir->gc_mark_time / freq));
+	table_put_name(ir, t, string("sweep_ms"), make_number_value(ir, 1000.0 * ir->gc_sweep_time / freq));
+	table_put_name(ir, t, string("max_pause_ms"), make_number_value(ir, 1000.0 * ir->gc_max_pause / freq));
+	table_put_name(ir, t, string("object_buckets"), make_number_value(ir, (double)pool_bucket_count(&ir->object_pool)));
+	table_put_name(ir, t, string("heap_buckets"), make_number_value(ir, (double)heap_buckets));
+	table_put_name(ir, t, string("heap_bytes"), make_number_value(ir, (double)heap_bytes(&ir->heap)));
+	return t;
+}
+
+Value runtime_hack_force_gc(Ir *ir, ValueArray args) {
 	//force_gc(ir);
 	printf("==============================\n");
 	printf("   Force gc is currently out  \n");
@@ -238,19 +271,20 @@ Value* runtime_hack_force_gc(Ir *ir, ValueArray args) {
 }
 
 void add_globals(Ir *ir) {
-	scope_add(ir, ir->global_scope, string("print"), make_native_function(ir, string("print"), runtime_print));
-	scope_add(ir, ir->global_scope, string("println"), make_native_function(ir, string("println"), runtime_println));
-	scope_add(ir, ir->global_scope, string("msgbox"), make_native_function(ir, string("msgbox"), runtime_msgbox));
-	scope_add(ir, ir->global_scope, string("type"), make_native_function(ir, string("type"), runtime_type));
-	scope_add(ir, ir->global_scope, string("input"), make_native_function(ir, string("input"), runtime_input));
-	scope_add(ir, ir->global_scope, string("str2num"), make_native_function(ir, string("str2num"), runtime_str2num));
-	scope_add(ir, ir->global_scope, string("num2str"), make_native_function(ir, string("num2str"), runtime_num2str));
-	scope_add(ir, ir->global_scope, string("input_hidden"), make_native_function(ir, string("input_hidden"), runtime_input_hidden));
-	scope_add(ir, ir->global_scope, string("format"), make_native_function(ir, string("format"), runtime_format));
-	scope_add(ir, ir->global_scope, string("len"), make_native_function(ir, string("len"), runtime_table_len));
-	scope_add(ir, ir->global_scope, string("pow"), make_native_function(ir, string("pow"), runtime_pow));
-	scope_add(ir, ir->global_scope, string("sqrt"), make_native_function(ir, string("sqrt"), runtime_sqrt));
+	global_add_builtin(ir, string("print"), make_native_function(ir, string("print"), runtime_print));
+	global_add_builtin(ir, string("println"), make_native_function(ir, string("println"), runtime_println));
+	global_add_builtin(ir, string("msgbox"), make_native_function(ir, string("msgbox"), runtime_msgbox));
+	global_add_builtin(ir, string("type"), make_native_function(ir, string("type"), runtime_type));
+	global_add_builtin(ir, string("input"), make_native_function(ir, string("input"), runtime_input));
+	global_add_builtin(ir, string("str2num"), make_native_function(ir, string("str2num"), runtime_str2num));
+	global_add_builtin(ir, string("num2str"), make_native_function(ir, string("num2str"), runtime_num2str));
+	global_add_builtin(ir, string("input_hidden"), make_native_function(ir, string("input_hidden"), runtime_input_hidden));
+	global_add_builtin(ir, string("format"), make_native_function(ir, string("format"), runtime_format));
+	global_add_builtin(ir, string("len"), make_native_function(ir, string("len"), runtime_table_len));
+	global_add_builtin(ir, string("pow"), make_native_function(ir, string("pow"), runtime_pow));
+	global_add_builtin(ir, string("sqrt"), make_native_function(ir, string("sqrt"), runtime_sqrt));
+	global_add_builtin(ir, string("gc_stats"), make_native_function(ir, string("gc_stats"), runtime_gc_stats));
 
 	//HACKS!!:
-	scope_add(ir, ir->global_scope, string("__XX_force_gc"), make_native_function(ir, string("__XX_force_gc"), runtime_hack_force_gc));
+	global_add_builtin(ir, string("__XX_force_gc"), make_native_function(ir, string("__XX_force_gc"), runtime_hack_force_gc));
 }
\ No newline at end of file
@@ -0,0 +1,1092 @@
+// Bytecode compiler and stack VM
+//
+// Functions are compiled from their parser Nodes into a linear array of 32-bit
+// instructions the first time they are called. The low 8 bits of an instruction
+// is the opcode and the upper 24 bits is its operand. Script to script calls
+// push a CallFrame and stay inside vm_execute, so running a script does not
+// recurse on the C stack. The old tree-walking evaluator is still available
+// with the -treewalk flag.
+//
+// Names are resolved while compiling. Arguments and vars get a slot in the
+// frame, slot i being base[i], and a var's slot is simply wherever its value
+// was pushed. Anything else is a global and gets an index into ir->globals.
+
+typedef uint32_t Instr;
+
+#define INSTR(_op, _a) ((Instr)(_op) | ((Instr)(_a) << 8))
+#define INSTR_OP(_i)   ((_i) & 0xFF)
+#define INSTR_A(_i)    ((_i) >> 8)
+#define INSTR_A_MAX    0xFFFFFF
+
+typedef enum OpCode {
+	OP_NULL,         // push null
+	OP_CONST,        // push constants[a]
+	OP_POP,          // pop one value
+	OP_DUP,          // duplicate the top value
+	OP_DUP2,         // duplicate the two top values
+	OP_STASH,        // insert a copy of the top value a values down
+
+	OP_POPN,         // pop a values, locals leaving a block
+	OP_GET_LOCAL,    // push base[a]
+	OP_SET_LOCAL,    // base[a] = pop
+	OP_GET_GLOBAL,   // push globals[a]
+	OP_SET_GLOBAL,   // globals[a] = pop
+
+	OP_NEW_TABLE,    // push {} with room for a positional entries
+	OP_TABLE_INIT,   // v = pop, k = pop, top[k] = v
+	OP_TABLE_BUILD,  // pop one value per entry of templates[a], push the table built from them
+	OP_GET_FIELD,    // t = pop, push t.names[a], caches[a] is the inline cache of the site
+	OP_SET_FIELD,    // v = pop, t = pop, t.names[a] = v
+	OP_GET_INDEX,    // i = pop, t = pop, push t[i]
+	OP_SET_INDEX,    // v = pop, i = pop, t = pop, t[i] = v
+
+	OP_ADD,
+	OP_SUB,
+	OP_MUL,
+	OP_DIV,
+	OP_MOD,
+	OP_EQ,
+	OP_NE,
+	OP_LT,
+	OP_LTE,
+	OP_GT,
+	OP_GTE,
+	OP_NEG,
+	OP_PLUS,
+	OP_NOT,
+
+	OP_JUMP,          // ip = a
+	OP_JUMP_IF_FALSE, // if !pop, ip = a
+	OP_LOOP,          // ip = a, backwards jump that also steps the gc
+	OP_LAND,          // if !top, top = 0 and ip = a, else pop. Short-circuits &&
+	OP_LOR,           // if top, top = 1 and ip = a, else pop. Short-circuits ||
+	OP_TO_BOOL,       // top = top != 0, checked as the right hand side of token a
+
+	OP_METHOD,        // t = pop, push t.names[a], push t
+	OP_CALL,          // call the function below a arguments
+	OP_CALL_METHOD,   // same as OP_CALL but the first argument is the table
+	OP_TAIL_CALL,     // OP_CALL in return position, replaces the current frame
+	OP_TAIL_CALL_METHOD,
+	OP_RETURN,        // return pop
+
+	OP_COUNT,
+} OpCode;
+
+char *op_names[OP_COUNT] = {
+	[OP_NULL]          = "null",
+	[OP_CONST]         = "const",
+	[OP_POP]           = "pop",
+	[OP_DUP]           = "dup",
+	[OP_DUP2]          = "dup2",
+	[OP_STASH]         = "stash",
+	[OP_POPN]          = "popn",
+	[OP_GET_LOCAL]     = "get_local",
+	[OP_SET_LOCAL]     = "set_local",
+	[OP_GET_GLOBAL]    = "get_global",
+	[OP_SET_GLOBAL]    = "set_global",
+	[OP_NEW_TABLE]     = "new_table",
+	[OP_TABLE_INIT]    = "table_init",
+	[OP_TABLE_BUILD]   = "table_build",
+	[OP_GET_FIELD]     = "get_field",
+	[OP_SET_FIELD]     = "set_field",
+	[OP_GET_INDEX]     = "get_index",
+	[OP_SET_INDEX]     = "set_index",
+	[OP_ADD]           = "add",
+	[OP_SUB]           = "sub",
+	[OP_MUL]           = "mul",
+	[OP_DIV]           = "div",
+	[OP_MOD]           = "mod",
+	[OP_EQ]            = "eq",
+	[OP_NE]            = "ne",
+	[OP_LT]            = "lt",
+	[OP_LTE]           = "lte",
+	[OP_GT]            = "gt",
+	[OP_GTE]           = "gte",
+	[OP_NEG]           = "neg",
+	[OP_PLUS]          = "plus",
+	[OP_NOT]           = "not",
+	[OP_JUMP]          = "jump",
+	[OP_JUMP_IF_FALSE] = "jump_if_false",
+	[OP_LOOP]          = "loop",
+	[OP_LAND]          = "land",
+	[OP_LOR]           = "lor",
+	[OP_TO_BOOL]       = "to_bool",
+	[OP_METHOD]        = "method",
+	[OP_CALL]          = "call",
+	[OP_CALL_METHOD]   = "call_method",
+	[OP_TAIL_CALL]     = "tail_call",
+	[OP_TAIL_CALL_METHOD] = "tail_call_method",
+	[OP_RETURN]        = "return",
+};
+
+typedef struct InstrLoc {
+	uint32_t line;
+	uint32_t offset;
+} InstrLoc;
+
+struct Chunk {
+	String file;
+	Array(Instr) code;
+	Array(InstrLoc) locs; // One per instruction, only used for errors
+	ValueArray constants;
+	ValueArray names;        // Interned field and method names, one per site
+	Array(InlineCache) caches; // Parallel to names
+	Array(TableTemplate*) templates;
+};
+
+struct CallFrame {
+	Function *func; // 0 for top level code
+	Chunk *chunk;
+	Instr *ip;
+	Value *base;    // First argument, followed by the locals
+};
+
+typedef struct Loop Loop;
+struct Loop {
+	Loop *outer;
+	size_t start;
+	int scope_depth;
+	Array(size_t) breaks;
+};
+
+typedef struct Compiler {
+	Ir *ir;
+	Chunk *chunk;
+	SourceLoc loc;
+	Resolver scope; // Arguments are the first locals
+	Loop *loop;
+	Map constant_slots; // Constant index + 1 of each distinct value in chunk
+} Compiler;
+
+Chunk* make_chunk(String file) {
+	Chunk *chunk = calloc(1, sizeof(Chunk));
+	chunk->file = file;
+	return chunk;
+}
+
+void free_chunk(Chunk *chunk) {
+	array_free(chunk->code);
+	array_free(chunk->locs);
+	array_free(chunk->constants);
+	array_free(chunk->names);
+	array_free(chunk->caches);
+	for (size_t i = 0; i < chunk->templates.size; i++) {
+		free_table_template(chunk->templates.data[i]);
+	}
+	array_free(chunk->templates);
+	free(chunk);
+}
+
+void gc_mark_chunk(Ir *ir, Chunk *chunk) {
+	Value v;
+	if (chunk->constants.size > 0) {
+		for_array(chunk->constants, v) {
+			gc_add_value_to_grey(ir, v);
+		}
+	}
+	if (chunk->names.size > 0) {
+		for_array(chunk->names, v) {
+			gc_add_value_to_grey(ir, v);
+		}
+	}
+}
+
+size_t emit(Compiler *c, OpCode op, size_t a) {
+	if (a > INSTR_A_MAX) {
+		ir_error(c->ir, "Function is too large to compile!");
+	}
+	array_add(c->chunk->code, INSTR(op, a));
+	InstrLoc loc = { (uint32_t)c->loc.line, (uint32_t)c->loc.offset };
+	array_add(c->chunk->locs, loc);
+	return c->chunk->code.size - 1;
+}
+
+size_t emit_jump(Compiler *c, OpCode op) {
+	return emit(c, op, 0);
+}
+
+void patch_jump(Compiler *c, size_t at) {
+	Instr *ins = &c->chunk->code.data[at];
+	*ins = INSTR(INSTR_OP(*ins), c->chunk->code.size);
+}
+
+// Identical constants share a slot, literal strings become immortal
+size_t add_constant(Compiler *c, Value v) {
+	v = make_literal(c->ir, v);
+	uint64_t hash = hash_uint64(v);
+	MapEntry *e = map_find(&c->constant_slots, hash, 0, &v);
+	if (e) return (size_t)e->val - 1;
+
+	array_add(c->chunk->constants, v);
+	map_insert(&c->constant_slots, hash, v, c->chunk->constants.size);
+	return c->chunk->constants.size - 1;
+}
+
+// Every field access and method call gets its own entry so they each have
+// their own inline cache
+size_t add_name(Compiler *c, String name) {
+	InlineCache cache = { 0 };
+	array_add(c->chunk->names, make_literal(c->ir, intern_string(c->ir, name)));
+	array_add(c->chunk->caches, cache);
+	return c->chunk->names.size - 1;
+}
+
+// Pops the locals deeper than to_depth without forgetting them, for jumps out of blocks
+void emit_pop_locals(Compiler *c, int to_depth) {
+	size_t count = count_locals_above(&c->scope, to_depth);
+	if (count > 0) {
+		emit(c, OP_POPN, count);
+	}
+}
+
+void compile_get_name(Compiler *c, String name) {
+	int slot = resolve_local(&c->scope, name);
+	if (slot >= 0) {
+		emit(c, OP_GET_LOCAL, slot);
+	}
+	else {
+		emit(c, OP_GET_GLOBAL, global_slot(c->ir, name));
+	}
+}
+
+void compile_set_name(Compiler *c, String name) {
+	int slot = resolve_local(&c->scope, name);
+	if (slot >= 0) {
+		emit(c, OP_SET_LOCAL, slot);
+	}
+	else {
+		emit(c, OP_SET_GLOBAL, global_slot(c->ir, name));
+	}
+}
+
+Value make_function_value(Ir *ir, String name, SourceLoc loc, StringArray arg_names, Node *block);
+void compile_stmt(Compiler *c, Node *n);
+void compile_expr(Compiler *c, Node *n);
+
+bool is_assignable(Node *n) {
+	return n->kind == NODE_NAME || n->kind == NODE_FIELD || n->kind == NODE_INDEX;
+}
+
+OpCode binop_to_opcode(TokenKind op) {
+	switch (op) {
+	case TOKEN_PLUS:     return OP_ADD;
+	case TOKEN_MINUS:    return OP_SUB;
+	case TOKEN_ASTERISK: return OP_MUL;
+	case TOKEN_SLASH:    return OP_DIV;
+	case TOKEN_MOD:      return OP_MOD;
+	case TOKEN_EQUALS:   return OP_EQ;
+	case TOKEN_NE:       return OP_NE;
+	case TOKEN_LT:       return OP_LT;
+	case TOKEN_LTE:      return OP_LTE;
+	case TOKEN_GT:       return OP_GT;
+	case TOKEN_GTE:      return OP_GTE;
+	default: {
+		assert(!"Unhandled binop kind!");
+		exit(1);
+	}
+	}
+}
+
+// Leaves the old value for post increments and the new value otherwise
+void compile_incdec(Compiler *c, Node *n) {
+	Node *target = n->incdec.expr;
+	if (!is_assignable(target)) {
+		ir_error(c->ir, "Cannot assign to left hand");
+	}
+	OpCode op = n->incdec.op == TOKEN_INCREMENT ? OP_ADD : OP_SUB;
+
+	// How many values the target needs below the new value
+	size_t depth = 0;
+	switch (target->kind) {
+	case NODE_NAME: {
+		compile_get_name(c, target->name.name);
+	} break;
+	case NODE_FIELD: {
+		compile_expr(c, target->field.expr);
+		emit(c, OP_DUP, 0);
+		emit(c, OP_GET_FIELD, add_name(c, target->field.name));
+		depth = 1;
+	} break;
+	case NODE_INDEX: {
+		compile_expr(c, target->index.expr);
+		compile_expr(c, target->index.index);
+		emit(c, OP_DUP2, 0);
+		emit(c, OP_GET_INDEX, 0);
+		depth = 2;
+	} break;
+	default: {
+		assert(!"Invalid incdec target");
+		exit(1);
+	} break;
+	}
+
+	if (n->incdec.post) emit(c, OP_STASH, depth);
+	emit(c, OP_CONST, add_constant(c, make_number_value(c->ir, 1)));
+	emit(c, op, 0);
+	if (!n->incdec.post) emit(c, OP_STASH, depth);
+
+	switch (target->kind) {
+	case NODE_NAME:  compile_set_name(c, target->name.name); break;
+	case NODE_FIELD: emit(c, OP_SET_FIELD, add_name(c, target->field.name)); break;
+	case NODE_INDEX: emit(c, OP_SET_INDEX, 0); break;
+	default: {
+		assert(!"Invalid incdec target");
+		exit(1);
+	} break;
+	}
+}
+
+void compile_table(Compiler *c, Node *n) {
+	TableTemplate *template = make_table_template(c->ir, n);
+	if (template) {
+		TableEntry *e;
+		if (n->table.entries.size > 0) {
+			for_array_ref(n->table.entries, e) {
+				compile_expr(c, e->expr);
+			}
+		}
+		array_add(c->chunk->templates, template);
+		emit(c, OP_TABLE_BUILD, c->chunk->templates.size - 1);
+		return;
+	}
+
+	size_t array_count = 0;
+	TableEntry *e;
+	if (n->table.entries.size > 0) {
+		for_array_ref(n->table.entries, e) {
+			if (e->kind == ENTRY_NORMAL) array_count++;
+		}
+	}
+	emit(c, OP_NEW_TABLE, array_count);
+
+	size_t index = 0;
+	if (n->table.entries.size > 0) {
+		for_array_ref(n->table.entries, e) {
+			switch (e->kind) {
+			case ENTRY_NORMAL: { // v
+				emit(c, OP_CONST, add_constant(c, make_number_value(c->ir, (double)index)));
+				index++;
+			} break;
+			case ENTRY_INDEX: { // [blah] = v
+				compile_expr(c, e->index);
+			} break;
+			case ENTRY_KEY: {   // name = v
+				emit(c, OP_CONST, add_constant(c, intern_string(c->ir, table_entry_name(c->ir, e))));
+			} break;
+			default: {
+				assert(!"Invalid table entry kind!");
+				exit(1);
+			} break;
+			}
+			compile_expr(c, e->expr);
+			emit(c, OP_TABLE_INIT, 0);
+		}
+	}
+}
+
+size_t compile_args(Compiler *c, NodeArray args) {
+	if (args.size > 0) {
+		Node *arg;
+		for_array(args, arg) {
+			compile_expr(c, arg);
+		}
+	}
+	return args.size;
+}
+
+void compile_expr(Compiler *c, Node *n) {
+	switch (n->kind) {
+	case NODE_NULL: {
+		emit(c, OP_NULL, 0);
+	} break;
+	case NODE_NUMBER: {
+		emit(c, OP_CONST, add_constant(c, make_number_value(c->ir, n->number.value)));
+	} break;
+	case NODE_STRING: {
+		emit(c, OP_CONST, add_constant(c, intern_string(c->ir, n->string.string)));
+	} break;
+	case NODE_NAME: {
+		compile_get_name(c, n->name.name);
+	} break;
+	case NODE_TABLE: {
+		compile_table(c, n);
+	} break;
+	case NODE_BINOP: {
+		TokenKind op = n->binary.op;
+		if (op == TOKEN_LAND || op == TOKEN_LOR) {
+			// Jump past the right hand side when the left decides the result
+			compile_expr(c, n->binary.lhs);
+			size_t end_jump = emit_jump(c, op == TOKEN_LAND ? OP_LAND : OP_LOR);
+			compile_expr(c, n->binary.rhs);
+			emit(c, OP_TO_BOOL, op);
+			patch_jump(c, end_jump);
+			break;
+		}
+		compile_expr(c, n->binary.lhs);
+		compile_expr(c, n->binary.rhs);
+		emit(c, binop_to_opcode(n->binary.op), 0);
+	} break;
+	case NODE_UNARY: {
+		compile_expr(c, n->unary.rhs);
+		switch (n->unary.op) {
+		case TOKEN_PLUS:  emit(c, OP_PLUS, 0); break;
+		case TOKEN_MINUS: emit(c, OP_NEG, 0); break;
+		case TOKEN_NOT:   emit(c, OP_NOT, 0); break;
+		default: {
+			assert(!"Invalid unary op");
+			exit(1);
+		} break;
+		}
+	} break;
+	case NODE_FIELD: {
+		compile_expr(c, n->field.expr);
+		emit(c, OP_GET_FIELD, add_name(c, n->field.name));
+	} break;
+	case NODE_INDEX: {
+		compile_expr(c, n->index.expr);
+		compile_expr(c, n->index.index);
+		emit(c, OP_GET_INDEX, 0);
+	} break;
+	case NODE_CALL: {
+		compile_expr(c, n->call.expr);
+		size_t argc = compile_args(c, n->call.args);
+		emit(c, OP_CALL, argc);
+	} break;
+	case NODE_METHOD_CALL: {
+		compile_expr(c, n->method_call.expr);
+		emit(c, OP_METHOD, add_name(c, n->method_call.name));
+		size_t argc = compile_args(c, n->method_call.args);
+		emit(c, OP_CALL_METHOD, argc + 1);
+	} break;
+	case NODE_ANON_FUNC: {
+		StringArray arg_names = { 0 };
+		if (n->anon_func.args.size > 0) {
+			String *str;
+			for_array_ref(n->anon_func.args, str) {
+				array_add(arg_names, make_string_copy(*str));
+			}
+		}
+		Value f = make_function_value(c->ir, string("<anonymous func>"), n->loc, arg_names, n->anon_func.block);
+		emit(c, OP_CONST, add_constant(c, f));
+	} break;
+	case NODE_INCDEC: {
+		compile_incdec(c, n);
+	} break;
+	default: {
+		assert(!"Node to bytecode conversion not added");
+		exit(1);
+	} break;
+	}
+}
+
+void compile_block(Compiler *c, NodeArray stmts) {
+	if (stmts.size > 0) {
+		Node *n;
+		for_array(stmts, n) {
+			compile_stmt(c, n);
+		}
+	}
+}
+
+void compile_stmt(Compiler *c, Node *n) {
+	c->loc = n->loc;
+	c->ir->loc = n->loc;
+	switch (n->kind) {
+	case NODE_VAR: {
+		if (n->var.expr) {
+			compile_expr(c, n->var.expr);
+		}
+		else {
+			emit(c, OP_NULL, 0);
+		}
+		// The value just pushed becomes the local's slot
+		declare_local(c->ir, &c->scope, n->var.name);
+	} break;
+	case NODE_RETURN: {
+		Node *expr = n->ret.expr;
+		if (expr && expr->kind == NODE_CALL) {
+			compile_expr(c, expr->call.expr);
+			size_t argc = compile_args(c, expr->call.args);
+			emit(c, OP_TAIL_CALL, argc);
+		}
+		else if (expr && expr->kind == NODE_METHOD_CALL) {
+			compile_expr(c, expr->method_call.expr);
+			emit(c, OP_METHOD, add_name(c, expr->method_call.name));
+			size_t argc = compile_args(c, expr->method_call.args);
+			emit(c, OP_TAIL_CALL_METHOD, argc + 1);
+		}
+		else if (expr) {
+			compile_expr(c, expr);
+		}
+		else {
+			emit(c, OP_NULL, 0);
+		}
+		emit(c, OP_RETURN, 0);
+	} break;
+	case NODE_BREAK: {
+		if (!c->loop) {
+			ir_error(c->ir, "'break' used outside of a loop!");
+		}
+		emit_pop_locals(c, c->loop->scope_depth);
+		array_add(c->loop->breaks, emit_jump(c, OP_JUMP));
+	} break;
+	case NODE_CONTINUE: {
+		if (!c->loop) {
+			ir_error(c->ir, "'continue' used outside of a loop!");
+		}
+		emit_pop_locals(c, c->loop->scope_depth);
+		emit(c, OP_LOOP, c->loop->start);
+	} break;
+	case NODE_BLOCK: {
+		if (n->block.stmts.size > 0) {
+			begin_scope(&c->scope);
+			compile_block(c, n->block.stmts);
+			size_t count = end_scope(&c->scope);
+			if (count > 0) {
+				emit(c, OP_POPN, count);
+			}
+		}
+	} break;
+	case NODE_ASSIGN: {
+		Node *lhs = n->assign.left;
+		switch (lhs->kind) {
+		case NODE_NAME: {
+			compile_expr(c, n->assign.right);
+			compile_set_name(c, lhs->name.name);
+		} break;
+		case NODE_FIELD: {
+			compile_expr(c, lhs->field.expr);
+			compile_expr(c, n->assign.right);
+			emit(c, OP_SET_FIELD, add_name(c, lhs->field.name));
+		} break;
+		case NODE_INDEX: {
+			compile_expr(c, lhs->index.expr);
+			compile_expr(c, lhs->index.index);
+			compile_expr(c, n->assign.right);
+			emit(c, OP_SET_INDEX, 0);
+		} break;
+		default: {
+			ir_error(c->ir, "Cannot assign to left hand");
+		} break;
+		}
+	} break;
+	case NODE_CALL:
+	case NODE_METHOD_CALL:
+	case NODE_INCDEC: {
+		compile_expr(c, n);
+		emit(c, OP_POP, 0);
+	} break;
+	case NODE_IF: {
+		compile_expr(c, n->_if.cond);
+		size_t else_jump = emit_jump(c, OP_JUMP_IF_FALSE);
+		compile_stmt(c, n->_if.block);
+		if (n->_if.else_block) {
+			size_t end_jump = emit_jump(c, OP_JUMP);
+			patch_jump(c, else_jump);
+			compile_stmt(c, n->_if.else_block);
+			patch_jump(c, end_jump);
+		}
+		else {
+			patch_jump(c, else_jump);
+		}
+	} break;
+	case NODE_WHILE: {
+		Loop loop = { 0 };
+		loop.outer = c->loop;
+		loop.start = c->chunk->code.size;
+		loop.scope_depth = c->scope.depth;
+		c->loop = &loop;
+
+		compile_expr(c, n->_while.cond);
+		size_t exit_jump = emit_jump(c, OP_JUMP_IF_FALSE);
+		compile_stmt(c, n->_while.block);
+		emit(c, OP_LOOP, loop.start);
+		patch_jump(c, exit_jump);
+
+		if (loop.breaks.size > 0) {
+			size_t at;
+			for_array(loop.breaks, at) {
+				patch_jump(c, at);
+			}
+		}
+		array_free(loop.breaks);
+		c->loop = loop.outer;
+	} break;
+	default: {
+		assert(!"Unhandled node to bytecode case!");
+		exit(1);
+	}
+	}
+}
+
+CallFrame* push_frame(Ir *ir);
+void compile_function(Ir *ir, Function *f) {
+	assert(f->kind == FUNCTION_NORMAL);
+	assert(!f->normal.chunk);
+
+	// Compile errors should point at the source, not at the caller
+	CallFrame *frame = ir->frame;
+	ir->frame = 0;
+
+	Compiler c = { 0 };
+	c.ir = ir;
+	c.chunk = make_chunk(f->loc.file);
+	c.loc = f->loc;
+	if (f->normal.arg_names.size > 0) {
+		String *arg;
+		for_array_ref(f->normal.arg_names, arg) {
+			declare_local(ir, &c.scope, *arg);
+		}
+	}
+	compile_block(&c, f->normal.block->block.stmts);
+	c.loc = f->loc;
+	emit(&c, OP_NULL, 0);
+	emit(&c, OP_RETURN, 0);
+	f->normal.chunk = c.chunk;
+	array_free(c.scope.locals);
+	map_free(&c.constant_slots);
+
+	ir->frame = frame;
+}
+
+Chunk* compile_top_level_expr(Ir *ir, Node *n) {
+	Compiler c = { 0 };
+	c.ir = ir;
+	c.chunk = make_chunk(n->loc.file);
+	c.loc = n->loc;
+	compile_expr(&c, n);
+	emit(&c, OP_RETURN, 0);
+	map_free(&c.constant_slots);
+	return c.chunk;
+}
+
+void vm_locate(Ir *ir) {
+	CallFrame *frame = ir->frame;
+	if (!frame || !frame->ip) return;
+
+	size_t at = frame->ip - frame->chunk->code.data;
+	if (at > 0) at--;
+	InstrLoc loc = frame->chunk->locs.data[at];
+	ir->loc.file = frame->chunk->file;
+	ir->loc.line = loc.line;
+	ir->loc.offset = loc.offset;
+}
+
+void init_vm(Ir *ir) {
+	ir->stack = calloc(VM_STACK_SIZE, sizeof(Value));
+	ir->stack_top = ir->stack;
+	ir->frames = calloc(VM_MAX_FRAMES, sizeof(CallFrame));
+	ir->frame_count = 0;
+	ir->frame = 0;
+}
+
+CallFrame* push_frame(Ir *ir) {
+	if (ir->frame_count == VM_MAX_FRAMES) {
+		ir_error(ir, "Stack overflow!");
+	}
+	CallFrame *frame = &ir->frames[ir->frame_count++];
+	memset(frame, 0, sizeof(CallFrame));
+	return frame;
+}
+
+// Sets up a frame for a normal function whose arguments are already on the stack
+CallFrame* vm_enter_function(Ir *ir, Function *func, Value *base, size_t argc, bool is_method_call) {
+	if (func->normal.arg_names.size != argc) {
+		if (is_method_call) {
+			ir_error(ir, "Argument count mismatch! Wanted %d got %d. This function was called as a method which means the left hand side of ':' is passed as the first argument.", (int)func->normal.arg_names.size, (int)argc);
+		}
+		else {
+			ir_error(ir, "Argument count mismatch! Wanted %d got %d.", (int)func->normal.arg_names.size, (int)argc);
+		}
+	}
+	if (!func->normal.chunk) {
+		compile_function(ir, func);
+	}
+
+	CallFrame *frame = push_frame(ir);
+	frame->func = func;
+	frame->chunk = func->normal.chunk;
+	frame->ip = frame->chunk->code.data;
+	frame->base = base;
+	return frame;
+}
+
+// Runs until the frame at index stop_frame returns, and returns its result
+Value vm_execute(Ir *ir, size_t stop_frame) {
+	CallFrame *frame = &ir->frames[ir->frame_count - 1];
+	Instr *ip = frame->ip;
+	Value *sp = ir->stack_top;
+	Value *slots = frame->base;
+	Value *constants = frame->chunk->constants.data;
+	Value *names = frame->chunk->names.data;
+	InlineCache *caches = frame->chunk->caches.data;
+	ir->frame = frame;
+	ir->vm_depth++;
+
+#define SAVE()    (frame->ip = ip, ir->stack_top = sp)
+#define PUSH(_v)  (*sp++ = (_v))
+#define POP()     (*--sp)
+#define PEEK(_n)  (sp[-1 - (_n)])
+#define LOAD_FRAME() do { \
+	frame = &ir->frames[ir->frame_count - 1]; \
+	ip = frame->ip; \
+	slots = frame->base; \
+	constants = frame->chunk->constants.data; \
+	names = frame->chunk->names.data; \
+	caches = frame->chunk->caches.data; \
+	ir->frame = frame; \
+} while (0)
+// Numbers are computed inline, anything else goes through eval_binop so the
+// errors match the tree walker
+#define BINARY(_tok, _op) do { \
+	Value rhs = POP(); \
+	Value lhs = POP(); \
+	if (isnumber(lhs) && isnumber(rhs)) { \
+		PUSH(make_number_value(ir, as_number(lhs) _op as_number(rhs))); \
+	} \
+	else { \
+		SAVE(); \
+		PUSH(eval_binop(ir, _tok, lhs, rhs)); \
+	} \
+} while (0)
+
+	for (;;) {
+		if (sp >= ir->stack + VM_STACK_SIZE - 256) {
+			SAVE();
+			ir_error(ir, "Stack overflow!");
+		}
+
+		Instr ins = *ip++;
+		switch (INSTR_OP(ins)) {
+		case OP_NULL: {
+			PUSH(null_value);
+		} break;
+		case OP_CONST: {
+			PUSH(constants[INSTR_A(ins)]);
+		} break;
+		case OP_POP: {
+			sp--;
+		} break;
+		case OP_DUP: {
+			Value v = PEEK(0);
+			PUSH(v);
+		} break;
+		case OP_DUP2: {
+			Value a = PEEK(1);
+			Value b = PEEK(0);
+			PUSH(a);
+			PUSH(b);
+		} break;
+		case OP_STASH: {
+			size_t depth = INSTR_A(ins);
+			Value v = PEEK(0);
+			memmove(sp - depth, sp - depth - 1, (depth + 1) * sizeof(Value));
+			sp[-1 - depth] = v;
+			sp++;
+		} break;
+
+		case OP_POPN: {
+			sp -= INSTR_A(ins);
+		} break;
+		case OP_GET_LOCAL: {
+			PUSH(slots[INSTR_A(ins)]);
+		} break;
+		case OP_SET_LOCAL: {
+			Value v = POP();
+			Value *slot = &slots[INSTR_A(ins)];
+			if (isobject(*slot) && !isstring(*slot) && !istable(*slot)) {
+				SAVE();
+				check_assign(ir, *slot);
+			}
+			*slot = v;
+		} break;
+		case OP_GET_GLOBAL: {
+			Value v = ir->globals.data[INSTR_A(ins)];
+			if (!v) {
+				SAVE();
+				global_get(ir, INSTR_A(ins));
+			}
+			PUSH(v);
+		} break;
+		case OP_SET_GLOBAL: {
+			Value v = POP();
+			SAVE();
+			global_set(ir, INSTR_A(ins), v);
+		} break;
+
+		case OP_NEW_TABLE: {
+			Value t = make_table_value(ir);
+			table_array_reserve(ir, as_object(t), INSTR_A(ins));
+			PUSH(t);
+		} break;
+		case OP_TABLE_BUILD: {
+			SAVE();
+			TableTemplate *template = frame->chunk->templates.data[INSTR_A(ins)];
+			sp -= template->slots.size;
+			Value t = make_table_from_template(ir, template, sp);
+			PUSH(t);
+		} break;
+		case OP_TABLE_INIT: {
+			SAVE();
+			Value v = POP();
+			Value k = POP();
+			table_put(ir, PEEK(0), k, v);
+		} break;
+		case OP_GET_FIELD: {
+			SAVE();
+			Value t = POP();
+			if (!istable(t)) {
+				ir_error(ir, "Left hand side of '.' it not a table!");
+			}
+			Value v = table_get_cached(ir, t, names[INSTR_A(ins)], &caches[INSTR_A(ins)]);
+			PUSH(v ? v : null_value);
+		} break;
+		case OP_SET_FIELD: {
+			SAVE();
+			Value v = POP();
+			Value t = POP();
+			if (!istable(t)) {
+				ir_error(ir, "Left hand side of '.' it not a table!");
+			}
+			table_put_cached(ir, t, names[INSTR_A(ins)], v, &caches[INSTR_A(ins)]);
+		} break;
+		case OP_GET_INDEX: {
+			SAVE();
+			Value index = POP();
+			Value t = POP();
+			if (!istable(t)) {
+				ir_error(ir, "Left hand side of '[]' operator is not a table!");
+			}
+			Value v = table_get(ir, t, index);
+			PUSH(v ? v : null_value);
+		} break;
+		case OP_SET_INDEX: {
+			SAVE();
+			Value v = POP();
+			Value index = POP();
+			Value t = POP();
+			if (!istable(t)) {
+				ir_error(ir, "Left hand side of '[]' operator is not a table!");
+			}
+			table_put(ir, t, index, v);
+		} break;
+
+		case OP_ADD:  BINARY(TOKEN_PLUS, +); break;
+		case OP_SUB:  BINARY(TOKEN_MINUS, -); break;
+		case OP_MUL:  BINARY(TOKEN_ASTERISK, *); break;
+		case OP_DIV:  BINARY(TOKEN_SLASH, /); break;
+		case OP_LT:   BINARY(TOKEN_LT, <); break;
+		case OP_LTE:  BINARY(TOKEN_LTE, <=); break;
+		case OP_GT:   BINARY(TOKEN_GT, >); break;
+		case OP_GTE:  BINARY(TOKEN_GTE, >=); break;
+		case OP_EQ:   BINARY(TOKEN_EQUALS, ==); break;
+		case OP_NE:   BINARY(TOKEN_NE, !=); break;
+		case OP_MOD: {
+			Value rhs = POP();
+			Value lhs = POP();
+			SAVE();
+			PUSH(eval_binop(ir, TOKEN_MOD, lhs, rhs));
+		} break;
+		case OP_NEG: {
+			SAVE();
+			sp[-1] = eval_unary(ir, TOKEN_MINUS, sp[-1]);
+		} break;
+		case OP_PLUS: {
+			SAVE();
+			sp[-1] = eval_unary(ir, TOKEN_PLUS, sp[-1]);
+		} break;
+		case OP_NOT: {
+			SAVE();
+			sp[-1] = eval_unary(ir, TOKEN_NOT, sp[-1]);
+		} break;
+
+		case OP_JUMP: {
+			ip = frame->chunk->code.data + INSTR_A(ins);
+		} break;
+		case OP_JUMP_IF_FALSE: {
+			Value cond = POP();
+			if (!isnumber(cond) && !isnull(cond)) {
+				SAVE();
+				ir_error(ir, "Condition does not evaluate to number or null.");
+			}
+			if (isnull(cond) || as_number(cond) == 0.0) {
+				ip = frame->chunk->code.data + INSTR_A(ins);
+			}
+		} break;
+		case OP_LOOP: {
+			ip = frame->chunk->code.data + INSTR_A(ins);
+			SAVE();
+			gc_step(ir);
+		} break;
+		case OP_LAND:
+		case OP_LOR: {
+			bool is_or = INSTR_OP(ins) == OP_LOR;
+			Value lhs = sp[-1];
+			if (!isnumber(lhs)) {
+				SAVE();
+				eval_logical_operand(ir, is_or ? TOKEN_LOR : TOKEN_LAND, lhs);
+			}
+			if ((as_number(lhs) != 0) == is_or) {
+				sp[-1] = make_number_value(ir, is_or);
+				ip = frame->chunk->code.data + INSTR_A(ins);
+			}
+			else {
+				sp--;
+			}
+		} break;
+		case OP_TO_BOOL: {
+			Value rhs = sp[-1];
+			if (!isnumber(rhs)) {
+				SAVE();
+			}
+			sp[-1] = make_number_value(ir, eval_logical_operand(ir, (TokenKind)INSTR_A(ins), rhs));
+		} break;
+
+		case OP_METHOD: {
+			SAVE();
+			Value table = POP();
+			if (!istable(table)) {
+				ir_error(ir, "':' operator only works with tables as lvalues");
+			}
+			Value name = names[INSTR_A(ins)];
+			Value func = table_get_cached(ir, table, name, &caches[INSTR_A(ins)]);
+			if (!func) {
+				ir_error(ir, "Table does not contain any value called: %.*s", (int)as_string(name).len, as_string(name).str);
+			}
+			if (!isfunction(func)) {
+				ir_error(ir, "Right hand side of ':' operator is not a function");
+			}
+			PUSH(func);
+			PUSH(table);
+		} break;
+		case OP_CALL:
+		case OP_CALL_METHOD: {
+			size_t argc = INSTR_A(ins);
+			bool is_method_call = INSTR_OP(ins) == OP_CALL_METHOD;
+			Value *base = sp - argc;
+			Value func_value = base[-1];
+			SAVE();
+			if (!isfunction(func_value)) {
+				ir_error(ir, "Tried to call a non-function value!");
+			}
+
+			Function *func = as_function(func_value);
+			if (func->kind == FUNCTION_NORMAL) {
+				push_call(ir, func);
+
+				vm_enter_function(ir, func, base, argc, is_method_call);
+				LOAD_FRAME();
+				gc_step(ir);
+			}
+			else {
+				// Natives read their arguments straight off the stack
+				ValueArray args = { base, argc, argc };
+				Value result = call_function(ir, func_value, args, is_method_call);
+				sp = base - 1;
+				PUSH(result);
+			}
+		} break;
+		case OP_TAIL_CALL:
+		case OP_TAIL_CALL_METHOD: {
+			size_t argc = INSTR_A(ins);
+			bool is_method_call = INSTR_OP(ins) == OP_TAIL_CALL_METHOD;
+			Value *base = sp - argc;
+			Value func_value = base[-1];
+			SAVE();
+			if (!isfunction(func_value)) {
+				ir_error(ir, "Tried to call a non-function value!");
+			}
+
+			Function *func = as_function(func_value);
+			if (func->kind == FUNCTION_NORMAL) {
+				// Move the callee and arguments down over the current frame and
+				// enter the callee in its place
+				Value *frame_base = frame->base;
+				memmove(frame_base - 1, base - 1, (argc + 1) * sizeof(Value));
+				sp = frame_base + argc;
+				ir->stack_top = sp;
+				ir->callstack.data[ir->callstack.size - 1].func = func;
+				ir->frame_count--;
+				ir->tail_calls++;
+
+				vm_enter_function(ir, func, frame_base, argc, is_method_call);
+				LOAD_FRAME();
+				gc_step(ir);
+			}
+			else {
+				// Natives return normally, the OP_RETURN that follows returns the result
+				ValueArray args = { base, argc, argc };
+				Value result = call_function(ir, func_value, args, is_method_call);
+				sp = base - 1;
+				PUSH(result);
+			}
+		} break;
+		case OP_RETURN: {
+			Value result = POP();
+			if (frame->func) {
+				pop_call(ir);
+			}
+			sp = frame->base - 1;
+
+			ir->frame_count--;
+			if (ir->frame_count == stop_frame) {
+				ir->stack_top = sp;
+				ir->frame = stop_frame > 0 ? &ir->frames[stop_frame - 1] : 0;
+				ir->vm_depth--;
+				return result;
+			}
+			LOAD_FRAME();
+			PUSH(result);
+		} break;
+
+		default: {
+			assert(!"Invalid opcode!");
+			exit(1);
+		} break;
+		}
+	}
+
+#undef SAVE
+#undef PUSH
+#undef POP
+#undef PEEK
+#undef LOAD_FRAME
+#undef BINARY
+}
+
+// Calls a function value from C, arguments are copied onto the VM stack
+Value vm_call(Ir *ir, Value func_value, ValueArray args) {
+	assert(isfunction(func_value));
+	Function *func = as_function(func_value);
+	if (func->kind != FUNCTION_NORMAL) {
+		return call_function(ir, func_value, args, false);
+	}
+
+	Value *base = ir->stack_top + 1;
+	*ir->stack_top++ = func_value;
+	for (size_t i = 0; i < args.size; i++) {
+		*ir->stack_top++ = args.data[i];
+	}
+
+	push_call(ir, func);
+
+	size_t stop_frame = ir->frame_count;
+	vm_enter_function(ir, func, base, args.size, false);
+	return vm_execute(ir, stop_frame);
+}
+
+// Evaluates a top level var initializer in the file scope
+Value vm_eval_top_level(Ir *ir, Node *expr) {
+	Chunk *chunk = compile_top_level_expr(ir, expr);
+
+	size_t stop_frame = ir->frame_count;
+	*ir->stack_top++ = null_value; // Takes the place of the callee
+	CallFrame *frame = push_frame(ir);
+	frame->chunk = chunk;
+	frame->ip = chunk->code.data;
+	frame->base = ir->stack_top;
+
+	Value v = vm_execute(ir, stop_frame);
+	free_chunk(chunk);
+	return v;
+}
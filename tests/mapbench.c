@@ -0,0 +1,208 @@
+// Compares the insert and lookup throughput of the Map in src/common.c with
+// the hash only map it replaced, which is kept here as OldMap.
+//
+// Build from the tests directory with for example:
+//   cl /O2 mapbench.c
+//   cc -O2 -DPOSIX=1 mapbench.c -o mapbench -lpthread
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#ifndef _WIN32
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+#include "../src/common.c"
+
+typedef struct OldMapEntry {
+	uint64_t val;
+	uint64_t hash;
+} OldMapEntry;
+
+typedef struct OldMap {
+	OldMapEntry *entries;
+	size_t len;
+	size_t cap;
+} OldMap;
+
+uint64_t old_map_get(OldMap *map, uint64_t hash) {
+	if (map->len == 0) return 0;
+
+	size_t i = (size_t)hash;
+	for (;;) {
+		i &= map->cap - 1;
+		OldMapEntry *entry = &map->entries[i];
+		if (entry->hash == hash) {
+			return entry->val;
+		}
+		else if (!entry->hash) {
+			return 0;
+		}
+		i++;
+	}
+}
+
+void old_map_put_hash(OldMap *map, uint64_t hash, uint64_t val);
+void old_map_grow(OldMap *map, size_t new_cap) {
+	new_cap = max(16, new_cap);
+	OldMap new_map = {
+		.entries = calloc(new_cap, sizeof(OldMapEntry)),
+		.cap = new_cap,
+	};
+
+	for (size_t i = 0; i < map->cap; i++) {
+		OldMapEntry *e = &map->entries[i];
+		if (e->hash) {
+			old_map_put_hash(&new_map, e->hash, e->val);
+		}
+	}
+
+	free(map->entries);
+	*map = new_map;
+}
+
+void old_map_put_hash(OldMap *map, uint64_t hash, uint64_t val) {
+	if (2 * map->len >= map->cap) {
+		old_map_grow(map, 2 * map->cap);
+	}
+
+	size_t i = (size_t)hash;
+	for (;;) {
+		i &= map->cap - 1;
+		OldMapEntry *e = &map->entries[i];
+		if (!e->hash) {
+			map->len++;
+			e->val = val;
+			e->hash = hash;
+			return;
+		}
+		else if (e->hash == hash) {
+			e->val = val;
+			return;
+		}
+		i++;
+	}
+}
+
+#define COUNT  1000000
+#define ROUNDS 10
+
+double seconds_since(clock_t start) {
+	return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+void report(const char *name, double old_time, double new_time, size_t ops) {
+	printf("%-24s old %7.1f Mops/s   new %7.1f Mops/s   %.2fx\n", name,
+		ops / old_time / 1e6, ops / new_time / 1e6, old_time / new_time);
+}
+
+int main() {
+	// Number keys are hashed the way tables hash them
+	uint64_t *keys = malloc(2 * COUNT * sizeof(uint64_t));
+	uint64_t *hashes = malloc(2 * COUNT * sizeof(uint64_t));
+	for (size_t i = 0; i < 2 * COUNT; i++) {
+		double d = (double)i;
+		memcpy(&keys[i], &d, sizeof(double));
+		hashes[i] = hash_uint64(keys[i]);
+	}
+
+	OldMap old_map = { 0 };
+	Map map = { 0 };
+	uint64_t sum = 0;
+
+	clock_t start = clock();
+	for (size_t i = 0; i < COUNT; i++) {
+		old_map_put_hash(&old_map, hashes[i], i + 1);
+	}
+	double old_insert = seconds_since(start);
+
+	start = clock();
+	for (size_t i = 0; i < COUNT; i++) {
+		map_insert(&map, hashes[i], keys[i], i + 1);
+	}
+	double new_insert = seconds_since(start);
+	report("insert number", old_insert, new_insert, COUNT);
+
+	start = clock();
+	for (int r = 0; r < ROUNDS; r++) {
+		for (size_t i = 0; i < COUNT; i++) {
+			sum += old_map_get(&old_map, hashes[i]);
+		}
+	}
+	double old_hit = seconds_since(start);
+
+	start = clock();
+	for (int r = 0; r < ROUNDS; r++) {
+		for (size_t i = 0; i < COUNT; i++) {
+			MapEntry *e = map_find(&map, hashes[i], 0, &keys[i]);
+			sum += e ? e->val : 0;
+		}
+	}
+	double new_hit = seconds_since(start);
+	report("lookup number hit", old_hit, new_hit, ROUNDS * COUNT);
+
+	start = clock();
+	for (int r = 0; r < ROUNDS; r++) {
+		for (size_t i = COUNT; i < 2 * COUNT; i++) {
+			sum += old_map_get(&old_map, hashes[i]);
+		}
+	}
+	double old_miss = seconds_since(start);
+
+	start = clock();
+	for (int r = 0; r < ROUNDS; r++) {
+		for (size_t i = COUNT; i < 2 * COUNT; i++) {
+			MapEntry *e = map_find(&map, hashes[i], 0, &keys[i]);
+			sum += e ? e->val : 0;
+		}
+	}
+	double new_miss = seconds_since(start);
+	report("lookup number miss", old_miss, new_miss, ROUNDS * COUNT);
+
+	// Remove every other key and put them back, the new map reuses the tombstones
+	start = clock();
+	for (size_t i = 0; i < COUNT; i += 2) {
+		map_remove(&map, map_find(&map, hashes[i], 0, &keys[i]));
+	}
+	for (size_t i = 0; i < COUNT; i += 2) {
+		map_insert(&map, hashes[i], keys[i], i + 1);
+	}
+	printf("%-24s new %7.1f Mops/s\n", "remove and reinsert", COUNT / seconds_since(start) / 1e6);
+
+	// Small string keyed maps like the fields of an object
+	static const char *names[] = { "x", "y", "z", "w", "width", "height", "name", "update", "draw", "pos", "vel", "color" };
+	const size_t name_count = sizeof(names) / sizeof(names[0]);
+	String strings[sizeof(names) / sizeof(names[0])];
+	OldMap old_fields = { 0 };
+	Map fields = { 0 };
+	for (size_t i = 0; i < name_count; i++) {
+		strings[i] = make_string_slow((char*)names[i]);
+		old_map_put_hash(&old_fields, hash_bytes(strings[i].str, strings[i].len), i + 1);
+		map_put_string(&fields, strings[i], i + 1);
+	}
+
+	start = clock();
+	for (int r = 0; r < ROUNDS * COUNT / 10; r++) {
+		String s = strings[r % name_count];
+		sum += old_map_get(&old_fields, hash_bytes(s.str, s.len));
+	}
+	double old_str = seconds_since(start);
+
+	start = clock();
+	for (int r = 0; r < ROUNDS * COUNT / 10; r++) {
+		sum += map_get_string(&fields, strings[r % name_count]);
+	}
+	double new_str = seconds_since(start);
+	report("lookup string field", old_str, new_str, ROUNDS * COUNT / 10);
+
+	printf("checksum %llu\n", (unsigned long long)sum);
+	return 0;
+}
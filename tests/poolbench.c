@@ -0,0 +1,114 @@
+// Stress test for the Pool in src/common.c. Releasing and sweeping should
+// cost the same per element however many there are, and freed slots should
+// be reused before the pool grows.
+//
+// Build from the tests directory with for example:
+//   cl /O2 poolbench.c
+//   cc -O2 -DPOSIX=1 poolbench.c -o poolbench -lpthread
+
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#ifndef _WIN32
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+#include "../src/common.c"
+
+#define ELEMENT_SIZE 64
+#define BUCKET_SIZE  1024
+#define MIN_COUNT    100000
+#define MAX_COUNT    3200000
+
+double seconds_since(clock_t start) {
+	return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+bool sweep_element(void *user, void *element) {
+	(*(size_t*)user)++;
+	return true;
+}
+
+// Sweeps every bucket on this thread the way the gc does on its sweeper
+size_t sweep_all(Pool *pool) {
+	size_t freed = 0;
+	pool_begin_sweep(pool);
+	pool_sweep_bucket(pool->current_bucket, sweep_element, &freed);
+	while (pool_sweep_next(pool, sweep_element, &freed));
+	return freed;
+}
+
+void free_buckets(Bucket *bucket) {
+	while (bucket) {
+		Bucket *next = bucket->next;
+		os_free(bucket->arena, bucket->bucket_size);
+		free(bucket->live);
+		free(bucket->marks);
+		free(bucket);
+		bucket = next;
+	}
+}
+
+void free_pool(Pool *pool) {
+	free_buckets(pool->current_bucket);
+	free_buckets(pool->partial_buckets);
+	free_buckets(pool->free_buckets);
+	free_buckets(pool->old_buckets);
+}
+
+int main() {
+	void **elements = malloc(MAX_COUNT * sizeof(void*));
+
+	printf("%10s %16s %16s %16s\n", "elements", "release ns/op", "sweep ns/freed", "buckets reused");
+	for (size_t count = MIN_COUNT; count <= MAX_COUNT; count *= 2) {
+		Pool pool = { 0 };
+		pool_init(&pool, ELEMENT_SIZE, BUCKET_SIZE);
+
+		// Release everything in a random order, the worst case for emptying buckets
+		for (size_t i = 0; i < count; i++) {
+			elements[i] = pool_alloc(&pool);
+		}
+		for (size_t i = count - 1; i > 0; i--) {
+			size_t j = ((size_t)rand() * RAND_MAX + rand()) % (i + 1);
+			void *tmp = elements[i];
+			elements[i] = elements[j];
+			elements[j] = tmp;
+		}
+		clock_t start = clock();
+		for (size_t i = 0; i < count; i++) {
+			pool_release(&pool, elements[i]);
+		}
+		double release = seconds_since(start);
+
+		// Keep every other element and sweep the rest
+		for (size_t i = 0; i < count; i++) {
+			elements[i] = pool_alloc(&pool);
+		}
+		for (size_t i = 0; i < count; i += 2) {
+			pool_mark(elements[i]);
+		}
+		start = clock();
+		size_t freed = sweep_all(&pool);
+		double sweep = seconds_since(start);
+		assert(freed == count / 2);
+
+		// The survivors left a hole in every bucket, filling them must not grow the pool
+		size_t buckets = pool.buckets;
+		for (size_t i = 0; i < count / 2; i++) {
+			pool_alloc(&pool);
+		}
+
+		printf("%10zu %16.1f %16.1f %16s\n", count, 1e9 * release / count, 1e9 * sweep / freed,
+			pool.buckets == buckets ? "yes" : "no");
+		free_pool(&pool);
+	}
+	return 0;
+}